@@ -19,6 +19,8 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long cache_hit_cnt;   /* Number of buffer cache hits. */
+    unsigned long long cache_miss_cnt;  /* Number of buffer cache misses. */
   };
 
 /* List of all block devices. */
@@ -139,6 +141,68 @@ block_write (struct block *block, block_sector_t sector, const void *buffer)
   block->write_cnt++;
 }
 
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Uses a single transfer if the driver supports it.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+  size_t i;
+
+  ASSERT (cnt > 0);
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  if (block->ops->read_multiple != NULL)
+    block->ops->read_multiple (block->aux, sector, cnt, buffer);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->read (block->aux, sector + i,
+                        buffer + i * BLOCK_SECTOR_SIZE);
+  block->read_cnt += cnt;
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Uses a single transfer if the driver supports it.  Returns
+   after the block device has acknowledged receiving the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                      const void *buffer_)
+{
+  const uint8_t *buffer = buffer_;
+  size_t i;
+
+  ASSERT (cnt > 0);
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  if (block->ops->write_multiple != NULL)
+    block->ops->write_multiple (block->aux, sector, cnt, buffer);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->write (block->aux, sector + i,
+                         buffer + i * BLOCK_SECTOR_SIZE);
+  block->write_cnt += cnt;
+}
+
+/* Records a lookup of one of BLOCK's sectors in a buffer cache,
+   which was a hit if HIT is true or a miss otherwise.  Used only
+   for statistics. */
+void
+block_note_cache_access (struct block *block, bool hit)
+{
+  if (hit)
+    block->cache_hit_cnt++;
+  else
+    block->cache_miss_cnt++;
+}
+
 /* Returns the number of sectors in BLOCK. */
 block_sector_t
 block_size (struct block *block)
@@ -174,6 +238,10 @@ block_print_stats (void)
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
                   block->read_cnt, block->write_cnt);
+          if (block->cache_hit_cnt != 0 || block->cache_miss_cnt != 0)
+            printf ("%s (%s): %llu cache hits, %llu cache misses\n",
+                    block->name, block_type_name (block->type),
+                    block->cache_hit_cnt, block->cache_miss_cnt);
         }
     }
 }
@@ -200,6 +268,8 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->cache_hit_cnt = 0;
+  block->cache_miss_cnt = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -11,9 +11,6 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -81,3 +78,51 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Starts a one-shot countdown of COUNT PIT cycles on CHANNEL,
+   using mode 0 ("interrupt on terminal count"): the channel's
+   output goes high, raising the interrupt, once COUNT cycles
+   have elapsed, and stays high until the channel is
+   reprogrammed.  COUNT must be between 1 and 65535, which at
+   PIT_HZ limits a single countdown to about 55 ms.  Used by
+   devices/timer.c to skip ticks while the CPU is idle. */
+void
+pit_configure_oneshot (int channel, uint16_t count)
+{
+  enum intr_level old_level;
+
+  ASSERT (channel == 0);
+  ASSERT (count > 0);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, (channel << 6) | 0x30);
+  outb (PIT_PORT_COUNTER (channel), count);
+  outb (PIT_PORT_COUNTER (channel), count >> 8);
+  intr_set_level (old_level);
+}
+
+/* Returns the number of PIT cycles remaining in a one-shot
+   countdown started on CHANNEL by pit_configure_oneshot(), or 0
+   if the countdown has already expired.  Uses the 8254
+   read-back command to latch the channel's status and count
+   together, so that the two are consistent. */
+uint16_t
+pit_oneshot_remaining (int channel)
+{
+  enum intr_level old_level;
+  uint8_t status;
+  uint16_t count;
+
+  ASSERT (channel == 0);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, 0xc0 | (2 << channel));
+  status = inb (PIT_PORT_COUNTER (channel));
+  count = inb (PIT_PORT_COUNTER (channel));
+  count |= inb (PIT_PORT_COUNTER (channel)) << 8;
+  intr_set_level (old_level);
+
+  /* Bit 7 of the status byte is the channel's output, which in
+     mode 0 goes high on terminal count. */
+  return status & 0x80 ? 0 : count;
+}
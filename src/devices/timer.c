@@ -4,6 +4,7 @@
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
@@ -20,33 +21,86 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
-/* O lista de thread-uri care dorm folosita de timer_sleep pentru a menaja intervalul de trezire. */
-static struct list sleeping_threads;
+/* Hierarchical timing wheel of sleeping threads, keyed by the
+   tick at which each thread should wake up.
 
-/* Lock dedicat pentru menajarea access-ului la sleeping_threads. */
-static struct lock sleeping_threads_list_lock;
+   Level 0 has one slot per tick for the next WHEEL_SIZE ticks.
+   Each higher level has slots that each cover WHEEL_SIZE times
+   as many ticks as a slot in the level below it.  Whenever the
+   level 0 index wraps around to 0, the current slot of level 1
+   is "cascaded", that is, its threads are redistributed into
+   level 0, and so on up the levels.  Insertion is O(1), and
+   each thread is moved at most once per level before it wakes.
+
+   The wheel is only accessed with interrupts disabled, so
+   timer_interrupt() can always wake threads on time. */
+#define WHEEL_BITS 6                       /* Bits of index per level. */
+#define WHEEL_SIZE (1 << WHEEL_BITS)       /* Slots per level. */
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 5                     /* Levels in the wheel. */
+#define WHEEL_SPAN ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+static struct list wheel[WHEEL_LEVELS][WHEEL_SIZE];
+
+/* Next tick whose level 0 slot has not yet been expired. */
+static int64_t wheel_ticks;
+
+/* If false (default), the timer interrupts TIMER_FREQ times per
+   second at all times.
+   If true, the periodic tick is stopped while the CPU is idle.
+   Controlled by kernel command-line option "-tickless". */
+bool timer_tickless;
+
+/* PIT cycles per timer tick. */
+#define TICK_COUNT ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Most ticks a single PIT one-shot countdown can cover. */
+#define IDLE_MAX_TICKS (UINT16_MAX / TICK_COUNT)
+
+/* True while the PIT is in one-shot mode for an idle period. */
+static bool idle_oneshot;
+
+/* Length of the current idle period, in ticks. */
+static int idle_oneshot_ticks;
 
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Time-stamp counter frequency in Hz, or 0 if the CPU has no
+   TSC or it has not been calibrated yet.  The TSC reading at
+   calibration is the zero point of timer_cycles() and
+   timer_nsec().  Initialized by timer_calibrate(). */
+static uint64_t tsc_hz;
+static uint64_t tsc_base;
+
+/* Number of timer ticks to count TSC cycles over. */
+#define TSC_CALIBRATE_TICKS (TIMER_FREQ / 10)
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static void tsc_calibrate (void);
+static void wheel_insert (struct thread *);
+static int wheel_cascade (int level);
+static void wheel_advance (void);
+static int64_t wheel_next_event (int64_t limit);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void)
 {
-  /* Initializeaza o lista goala de thread-uri sleeping */
-  list_init(&sleeping_threads); 
-  
-  /* Initializarea lock-ului dedicat lui sleeping_threads */
-  lock_init(&sleeping_threads_list_lock);
-  
+  int level, slot;
+
+  /* Initializeaza roata de thread-uri sleeping */
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SIZE; slot++)
+      list_init (&wheel[level][slot]);
+  wheel_ticks = 0;
+
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -76,6 +130,39 @@ timer_calibrate (void)
       loops_per_tick |= test_bit;
 
   printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+
+  tsc_calibrate ();
+}
+
+/* Measures the TSC frequency against the PIT by counting TSC
+   cycles across TSC_CALIBRATE_TICKS timer ticks. */
+static void
+tsc_calibrate (void)
+{
+  int64_t start;
+  uint64_t tsc_start;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  if ((cpuid_features_edx () & CPUID_EDX_TSC) == 0)
+    {
+      printf ("No time-stamp counter, timer_nsec() has tick resolution.\n");
+      return;
+    }
+
+  /* Wait for a timer tick, so that we start on a tick edge. */
+  start = ticks;
+  while (ticks == start)
+    barrier ();
+
+  start = ticks;
+  tsc_start = rdtsc ();
+  while (ticks - start < TSC_CALIBRATE_TICKS)
+    barrier ();
+
+  tsc_base = tsc_start;
+  tsc_hz = (rdtsc () - tsc_start) * TIMER_FREQ / TSC_CALIBRATE_TICKS;
+  printf ("Time-stamp counter runs at %'"PRIu64" Hz.\n", tsc_hz);
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -96,30 +183,63 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns the number of time-stamp counter cycles since the
+   TSC was calibrated at boot, or 0 if there is no usable TSC. */
+uint64_t
+timer_cycles (void)
+{
+  return tsc_hz != 0 ? rdtsc () - tsc_base : 0;
+}
+
+/* Converts CYCLES time-stamp counter cycles into nanoseconds.
+   Returns 0 if there is no usable TSC. */
+uint64_t
+timer_cycles_to_nsec (uint64_t cycles)
+{
+  if (tsc_hz == 0)
+    return 0;
+
+  /* Split the conversion so that the intermediate product
+     cannot overflow 64 bits. */
+  return (cycles / tsc_hz * 1000000000
+          + cycles % tsc_hz * 1000000000 / tsc_hz);
+}
+
+/* Returns a monotonic count of nanoseconds since boot.  Uses the
+   time-stamp counter if available, otherwise falls back to the
+   timer tick count, with a resolution of one tick. */
+uint64_t
+timer_nsec (void)
+{
+  if (tsc_hz != 0)
+    return timer_cycles_to_nsec (timer_cycles ());
+  else
+    return timer_ticks () * (1000000000 / TIMER_FREQ);
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
 void
 timer_sleep (int64_t ticks)
 {
-  int64_t start = timer_ticks ();
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
 
   ASSERT (intr_get_level () == INTR_ON);
 
+  if (ticks <= 0)
+    return;
+
+  old_level = intr_disable ();
+
   /* Adaugarea timpului de trezire. */
-  thread_current()->sleep_duration = start + ticks;
-
-  /* Initializarea semaforului. */
-  sema_init(&(thread_current()->sema), 0);
-  
-  lock_acquire(&sleeping_threads_list_lock);
-  
-  /* Adauga thread in lista de sleep si o ordoneaza */
-  list_insert_ordered(&sleeping_threads, &(thread_current()->timer_sleep_elem), thread_sleep_compare, NULL);
-  
-  lock_release(&sleeping_threads_list_lock);
-  
-  /* Pune thread-ul la somn prin decrementarea semaforului. */
-  sema_down(&(thread_current()->sema));
+  cur->sleep_duration = timer_ticks () + ticks;
+
+  /* Adauga thread-ul in roata si il pune la somn. */
+  wheel_insert (cur);
+  thread_block ();
+
+  intr_set_level (old_level);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -185,6 +305,69 @@ timer_ndelay (int64_t ns)
   real_time_delay (ns, 1000 * 1000 * 1000);
 }
 
+/* Called by the idle thread, with interrupts off, just before it
+   halts the CPU.  If tickless mode is enabled and no sleeping
+   thread is due within the next tick, stops the periodic tick
+   and reprograms the PIT to interrupt once, when the next
+   sleeping thread is due.  The PIT can only count about 55 ms
+   at a time, so long idle periods are covered by a series of
+   one-shot interrupts.  Returns true if the periodic tick was
+   stopped. */
+bool
+timer_idle_enter (void)
+{
+  int64_t next;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!timer_tickless || idle_oneshot)
+    return false;
+
+  next = wheel_next_event (ticks + IDLE_MAX_TICKS);
+  if (next - ticks < 2)
+    return false;
+
+  idle_oneshot = true;
+  idle_oneshot_ticks = next - ticks;
+  pit_configure_oneshot (0, idle_oneshot_ticks * TICK_COUNT);
+  return true;
+}
+
+/* Called at the start of every external interrupt.  If the
+   interrupt ended a tickless idle period, restarts the periodic
+   tick and brings `ticks' up to date, running the per-tick work
+   for each tick that was skipped.  When the one-shot countdown
+   has expired, the final tick is left to the timer interrupt
+   that the expiry raised.  A partial tick is lost when another
+   interrupt ends the idle period early. */
+void
+timer_idle_exit (void)
+{
+  uint16_t remaining;
+  int64_t elapsed;
+
+  if (!idle_oneshot)
+    return;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  remaining = pit_oneshot_remaining (0);
+  pit_configure_channel (0, 2, TIMER_FREQ);
+  idle_oneshot = false;
+
+  if (remaining == 0)
+    elapsed = idle_oneshot_ticks - 1;
+  else
+    elapsed = (idle_oneshot_ticks * TICK_COUNT - remaining) / TICK_COUNT;
+
+  while (elapsed-- > 0)
+    {
+      ticks++;
+      thread_tick ();
+    }
+  wheel_advance ();
+}
+
 /* Prints timer statistics. */
 void
 timer_print_stats (void)
@@ -198,33 +381,118 @@ timer_interrupt (struct intr_frame *args UNUSED)
 {
   ticks++;
   thread_tick ();
-  
-  /* Verifica daca sunt tread-uri disponibile pentru trezire */
-  while (!list_empty(&sleeping_threads))
-  {
-    /* Alege primul thread cu cel mai scurt sleeping_time */
-    struct thread *front_thread = list_entry(list_front(&sleeping_threads), struct thread, timer_sleep_elem);
-    
-    if (front_thread->sleep_duration < ticks)
+
+  /* Trezeste thread-urile al caror timp de somn a expirat */
+  wheel_advance ();
+}
+
+/* Adds sleeping thread T to the timing wheel, in the slot for
+   its wake-up tick T->sleep_duration.  Interrupts must be off. */
+static void
+wheel_insert (struct thread *t)
+{
+  int64_t wake = t->sleep_duration;
+  int64_t delta = wake - wheel_ticks;
+  int level;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (delta < 0)
     {
-      /* Incercare apelare lock */
-      if (lock_try_acquire(&sleeping_threads_list_lock))
-      {
-        sema_up(&(front_thread->sema));
-        list_pop_front(&sleeping_threads);
-        lock_release(&sleeping_threads_list_lock);
-      }
-      else
-      {
-        break;
-      }
+      /* Already due: expire on the next tick processed. */
+      wake = wheel_ticks;
+      level = 0;
     }
-    else
+  else
+    {
+      /* Threads sleeping beyond the wheel's span are parked in
+         the farthest slot and re-inserted when it cascades. */
+      if (delta >= WHEEL_SPAN)
+        wake = wheel_ticks + WHEEL_SPAN - 1;
+      for (level = 0; level < WHEEL_LEVELS - 1; level++)
+        if (delta < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+          break;
+    }
+
+  list_push_back (&wheel[level][(wake >> (WHEEL_BITS * level)) & WHEEL_MASK],
+                  &t->timer_sleep_elem);
+}
+
+/* Redistributes the threads in the current slot of LEVEL into
+   lower levels.  Returns the index of the slot cascaded. */
+static int
+wheel_cascade (int level)
+{
+  int slot = (wheel_ticks >> (WHEEL_BITS * level)) & WHEEL_MASK;
+  struct list *bucket = &wheel[level][slot];
+
+  while (!list_empty (bucket))
+    wheel_insert (list_entry (list_pop_front (bucket),
+                              struct thread, timer_sleep_elem));
+  return slot;
+}
+
+/* Returns the earliest tick, no later than LIMIT, at which the
+   timing wheel has work to do: either a level 0 slot with a
+   sleeping thread in it, or a cascade from the levels above.
+   Interrupts must be off. */
+static int64_t
+wheel_next_event (int64_t limit)
+{
+  int64_t t;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (t = wheel_ticks; t < limit; t++)
+    {
+      int slot = t & WHEEL_MASK;
+      if (!list_empty (&wheel[0][slot]) || slot == 0)
+        return t;
+    }
+  return limit;
+}
+
+/* Wakes every thread whose wake-up tick is at or before the
+   current tick, cascading higher levels of the wheel as their
+   slots come due.  Called from the timer interrupt handler. */
+static void
+wheel_advance (void)
+{
+  struct thread *cur = thread_current ();
+  bool preempt = false;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (wheel_ticks <= ticks)
     {
-      break;
+      int slot = wheel_ticks & WHEEL_MASK;
+      struct list *bucket = &wheel[0][slot];
+      int level;
+
+      if (slot == 0)
+        for (level = 1; level < WHEEL_LEVELS; level++)
+          if (wheel_cascade (level) != 0)
+            break;
+
+      while (!list_empty (bucket))
+        {
+          struct thread *t = list_entry (list_pop_front (bucket),
+                                         struct thread, timer_sleep_elem);
+          if (t->sleep_duration > wheel_ticks)
+            {
+              /* Parked beyond the wheel's span; not due yet. */
+              wheel_insert (t);
+              continue;
+            }
+          thread_unblock (t);
+          if (thread_effective_priority (t) > thread_effective_priority (cur))
+            preempt = true;
+        }
+      wheel_ticks++;
     }
-  }
 
+  if (preempt)
+    intr_yield_on_return ();
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -292,6 +560,22 @@ real_time_sleep (int64_t num, int32_t denom)
 static void
 real_time_delay (int64_t num, int32_t denom)
 {
+  if (tsc_hz != 0)
+    {
+      /* Spin on the time-stamp counter, which is far more
+         precise than the calibrated loop.  Split the conversion
+         so that the intermediate product cannot overflow. */
+      uint64_t cycles, start;
+
+      if (num <= 0)
+        return;
+      cycles = num / denom * tsc_hz + num % denom * tsc_hz / denom;
+      start = rdtsc ();
+      while (rdtsc () - start < cycles)
+        barrier ();
+      return;
+    }
+
   /* Scale the numerator and denominator down by 1000 to avoid
      the possibility of overflow. */
   ASSERT (denom % 1000 == 0);
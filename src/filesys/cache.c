@@ -0,0 +1,694 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* A cached block. */
+struct cache_block
+  {
+    /* Locking to prevent eviction. */
+    struct lock block_lock;                  /* Protects fields in group. */
+    struct condition no_readers_or_writers;  /* readers == 0 && writers == 0 */
+    struct condition no_writers;             /*                writers == 0 */
+    int readers, read_waiters;               /* # of readers, # waiting to read. */
+    int writers, write_waiters;              /* # of writers (<= 1), # waiting to write. */
+
+    /* Sector number.  INVALID_SECTOR indicates a free cache block.
+
+       Changing from free to allocated requires cache_sync.
+
+       Changing from allocated to free requires block_lock, block
+       must be up-to-date and not dirty, and no one may be
+       waiting on it. */
+    block_sector_t sector;
+
+    /* Set to true whenever the block is locked, cleared by the
+       clock hand when it passes over the block.  Gives recently
+       used blocks a second chance before eviction.  Protected by
+       block_lock. */
+    bool accessed;
+
+    /* Is data[] correct?
+       Requires data_lock. */
+    bool up_to_date;
+
+    /* Does data[] need to be written back to disk?
+       Valid only when up-to-date.
+       Requires data_lock, except that flush_dirty() reads it
+       without, as a hint that lock_for_flush() checks again. */
+    bool dirty;
+
+    /* Sector data.
+       Access to data[] requires data_lock. */
+    struct lock data_lock;                   /* Protects fields in group. */
+    uint8_t data[BLOCK_SECTOR_SIZE];         /* Disk data. */
+  };
+
+/* Cache. */
+#define CACHE_CNT 64
+static struct cache_block cache[CACHE_CNT];
+
+/* Cache lock.
+
+   Required to allocate a cache block to a sector, to prevent a
+   single sector being allocated two different cache blocks.
+
+   Required to search the cache for a sector, to prevent the
+   sector from being added while the search is ongoing.
+
+   Protects hand. */
+static struct lock cache_sync;
+
+/* Cache eviction hand.
+   Protected by cache_sync. */
+static int hand = 0;
+
+/* Most sectors that the read-ahead and flush daemons move in a
+   single multi-sector transfer. */
+#define RUN_MAX 8
+
+/* If false, cache_readahead() does nothing.
+   Controlled by kernel command-line option "-no-readahead". */
+bool cache_readahead_enabled = true;
+
+/* A run of blocks to read ahead. */
+struct readahead_block
+  {
+    struct list_elem list_elem;         /* readahead_list element. */
+    block_sector_t sector;              /* First sector to read. */
+    size_t cnt;                         /* Number of sectors. */
+  };
+
+/* Most read-ahead requests allowed to be pending at once. */
+#define READAHEAD_MAX 64
+
+/* Protects readahead_list and readahead_cnt. */
+static struct lock readahead_lock;
+
+/* List of blocks for read-ahead, and its length. */
+static struct list readahead_list;
+static int readahead_cnt;
+
+/* Upped once per block added to readahead_list. */
+static struct semaphore readahead_avail;
+
+static thread_func readahead_daemon;
+
+/* Transfer buffer for readahead_daemon(). */
+static uint8_t readahead_buf[RUN_MAX * BLOCK_SECTOR_SIZE];
+
+/* Interval at which the flush daemon writes dirty blocks back to
+   disk, in timer ticks. */
+#define FLUSH_TICKS TIMER_FREQ
+
+static thread_func flush_daemon;
+
+/* Serializes flushes, which share flush_buf. */
+static struct lock flush_lock;
+static uint8_t flush_buf[RUN_MAX * BLOCK_SECTOR_SIZE];
+
+/* Initializes cache. */
+void
+cache_init (void)
+{
+  int i;
+
+  lock_init (&cache_sync);
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_block *b = &cache[i];
+      lock_init (&b->block_lock);
+      cond_init (&b->no_readers_or_writers);
+      cond_init (&b->no_writers);
+      b->readers = b->read_waiters = 0;
+      b->writers = b->write_waiters = 0;
+      b->sector = INVALID_SECTOR;
+      b->accessed = false;
+      lock_init (&b->data_lock);
+    }
+
+  lock_init (&flush_lock);
+  lock_init (&readahead_lock);
+  list_init (&readahead_list);
+  readahead_cnt = 0;
+  sema_init (&readahead_avail, 0);
+  thread_create ("readahead", PRI_DEFAULT, readahead_daemon, NULL);
+  thread_create ("flush", PRI_DEFAULT, flush_daemon, NULL);
+}
+
+/* A dirty block found by flush_dirty(). */
+struct flush_entry
+  {
+    block_sector_t sector;              /* Sector held by BLOCK. */
+    struct cache_block *block;          /* Cache block. */
+  };
+
+/* Compares the sectors of flush entries A_ and B_, for qsort(). */
+static int
+compare_flush_entries (const void *a_, const void *b_)
+{
+  const struct flush_entry *a = a_;
+  const struct flush_entry *b = b_;
+
+  return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
+
+/* Locks block B for reading if it still holds SECTOR and is
+   dirty, and returns true if successful.  Holding a read lock
+   keeps writers out while the data goes to disk but lets readers
+   carry on.  If WAIT is true, waits for any writer to finish with
+   the block first; otherwise, fails if anyone is writing it or
+   waiting to. */
+static bool
+lock_for_flush (struct cache_block *b, block_sector_t sector, bool wait)
+{
+  bool dirty;
+
+  lock_acquire (&b->block_lock);
+  if (b->sector != sector
+      || (!wait && (b->writers || b->write_waiters)))
+    {
+      lock_release (&b->block_lock);
+      return false;
+    }
+  b->read_waiters++;
+  if (b->writers || b->write_waiters)
+    do {
+      cond_wait (&b->no_writers, &b->block_lock);
+    } while (b->writers);
+  b->readers++;
+  b->read_waiters--;
+  lock_release (&b->block_lock);
+
+  lock_acquire (&b->data_lock);
+  dirty = b->up_to_date && b->dirty;
+  lock_release (&b->data_lock);
+  if (!dirty)
+    cache_unlock (b);
+  return dirty;
+}
+
+/* Writes the CNT blocks in ENTRIES, which hold consecutive
+   sectors and have been locked by lock_for_flush(), back to disk
+   in a single transfer, then unlocks them. */
+static void
+flush_run (const struct flush_entry *entries, size_t cnt)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&flush_lock));
+  ASSERT (cnt > 0 && cnt <= RUN_MAX);
+
+  if (cnt == 1)
+    block_write (fs_device, entries[0].sector, entries[0].block->data);
+  else
+    {
+      for (i = 0; i < cnt; i++)
+        memcpy (flush_buf + i * BLOCK_SECTOR_SIZE, entries[i].block->data,
+                BLOCK_SECTOR_SIZE);
+      block_write_multiple (fs_device, entries[0].sector, cnt, flush_buf);
+    }
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct cache_block *b = entries[i].block;
+
+      lock_acquire (&b->data_lock);
+      b->dirty = false;
+      lock_release (&b->data_lock);
+      cache_unlock (b);
+    }
+}
+
+/* Writes dirty blocks back to disk in ascending sector order, so
+   that the disk sees a single sweep instead of seeking back and
+   forth, and runs of consecutive sectors go out in one transfer.
+   If WAIT is true, every block that is dirty on entry is
+   written; otherwise, blocks that are busy being written are
+   left for a later pass. */
+static void
+flush_dirty (bool wait)
+{
+  struct flush_entry entries[CACHE_CNT];
+  size_t cnt = 0;
+  size_t i;
+
+  lock_acquire (&flush_lock);
+
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_block *b = &cache[i];
+
+      /* DIRTY belongs to data_lock, which a writer may hold for
+         as long as it likes, so read it without: it's only a hint
+         for picking candidates, and lock_for_flush() checks it
+         again under data_lock.  A block dirtied before this
+         function was called is seen here, because dirtying it
+         finished first. */
+      lock_acquire (&b->block_lock);
+      if (b->sector != INVALID_SECTOR && b->dirty)
+        {
+          entries[cnt].sector = b->sector;
+          entries[cnt].block = b;
+          cnt++;
+        }
+      lock_release (&b->block_lock);
+    }
+
+  qsort (entries, cnt, sizeof *entries, compare_flush_entries);
+  for (i = 0; i < cnt; )
+    {
+      /* Lock as long a run of consecutive sectors as we can. */
+      size_t run = 0;
+      while (i + run < cnt && run < RUN_MAX
+             && entries[i + run].sector == entries[i].sector + run
+             && lock_for_flush (entries[i + run].block,
+                                entries[i + run].sector, wait))
+        run++;
+
+      if (run > 0)
+        {
+          flush_run (entries + i, run);
+          i += run;
+        }
+      else
+        i++;
+    }
+
+  lock_release (&flush_lock);
+}
+
+/* Flushes cache to disk. */
+void
+cache_flush (void)
+{
+  flush_dirty (true);
+}
+
+/* Wakes up the threads waiting on B, if any, after B's last
+   reader or writer has unlocked it.  B's block_lock must be
+   held. */
+static void
+wake_waiters (struct cache_block *b)
+{
+  ASSERT (lock_held_by_current_thread (&b->block_lock));
+  ASSERT (b->readers == 0 && b->writers == 0);
+
+  if (b->read_waiters > 0)
+    cond_broadcast (&b->no_writers, &b->block_lock);
+  else if (b->write_waiters > 0)
+    cond_signal (&b->no_readers_or_writers, &b->block_lock);
+}
+
+/* Locks the given SECTOR into the cache and returns the cache
+   block.
+   If TYPE is EXCLUSIVE, then the block returned will be locked
+   only by the caller.  The calling thread must not already
+   have any lock on the block.
+   If TYPE is NON_EXCLUSIVE, then block returned may be locked by
+   any number of other callers.  The calling thread may already
+   have any number of non-exclusive locks on the block. */
+struct cache_block *
+cache_lock (block_sector_t sector, enum lock_type type)
+{
+  int i;
+
+ try_again:
+  lock_acquire (&cache_sync);
+
+  /* Is the block already in-cache? */
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      /* Skip any blocks that don't hold SECTOR. */
+      struct cache_block *b = &cache[i];
+      lock_acquire (&b->block_lock);
+      if (b->sector != sector)
+        {
+          lock_release (&b->block_lock);
+          continue;
+        }
+      lock_release (&cache_sync);
+      block_note_cache_access (fs_device, true);
+
+      /* Get read or write lock. */
+      if (type == NON_EXCLUSIVE)
+        {
+          /* Lock for read. */
+          b->read_waiters++;
+          if (b->writers || b->write_waiters)
+            do {
+              cond_wait (&b->no_writers, &b->block_lock);
+            } while (b->writers);
+          b->readers++;
+          b->read_waiters--;
+        }
+      else
+        {
+          /* Lock for write. */
+          b->write_waiters++;
+          if (b->readers || b->read_waiters || b->writers)
+            do {
+              cond_wait (&b->no_readers_or_writers, &b->block_lock);
+            } while (b->readers || b->writers);
+          b->writers++;
+          b->write_waiters--;
+        }
+      b->accessed = true;
+      lock_release (&b->block_lock);
+
+      /* Our sector should have been pinned in the cache while we
+         were waiting.  Make sure. */
+      ASSERT (b->sector == sector);
+
+      return b;
+    }
+
+  /* Not in cache.  Find empty slot.
+     We hold cache_sync. */
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_block *b = &cache[i];
+      lock_acquire (&b->block_lock);
+      if (b->sector == INVALID_SECTOR)
+        {
+          /* Drop block_lock, which is no longer needed because
+             this is the only code that allocates free blocks,
+             and we still have cache_sync.
+
+             We can't drop cache_sync yet because someone else
+             might try to allocate this same block (or read from
+             it) while we're still initializing the block. */
+          lock_release (&b->block_lock);
+
+          b->sector = sector;
+          b->up_to_date = false;
+          b->accessed = true;
+          ASSERT (b->readers == 0);
+          ASSERT (b->writers == 0);
+          if (type == NON_EXCLUSIVE)
+            b->readers = 1;
+          else
+            b->writers = 1;
+          lock_release (&cache_sync);
+          block_note_cache_access (fs_device, false);
+          return b;
+        }
+      lock_release (&b->block_lock);
+    }
+
+  /* No empty slots.  Evict something.
+     We hold cache_sync.
+
+     This is the clock algorithm: blocks used since the hand last
+     passed over them get a second chance, so the hand may have
+     to sweep the cache twice. */
+  for (i = 0; i < CACHE_CNT * 2; i++)
+    {
+      /* Skip any block that's in use or has been used recently. */
+      struct cache_block *b = &cache[hand];
+      if (++hand >= CACHE_CNT)
+        hand = 0;
+      if (!lock_try_acquire (&b->block_lock))
+        continue;
+      if (b->readers || b->writers || b->read_waiters || b->write_waiters)
+        {
+          lock_release (&b->block_lock);
+          continue;
+        }
+      if (b->accessed)
+        {
+          b->accessed = false;
+          lock_release (&b->block_lock);
+          continue;
+        }
+      b->writers = 1;
+      lock_release (&b->block_lock);
+
+      lock_release (&cache_sync);
+
+      /* Write block to disk if dirty. */
+      lock_acquire (&b->data_lock);
+      if (b->up_to_date && b->dirty)
+        {
+          block_write (fs_device, b->sector, b->data);
+          b->dirty = false;
+        }
+      lock_release (&b->data_lock);
+
+      /* Remove block from cache, if possible: someone might have
+         started waiting on it while the lock was released. */
+      lock_acquire (&b->block_lock);
+      b->writers = 0;
+      if (!b->read_waiters && !b->write_waiters)
+        {
+          /* No one is waiting for it, so we can free it. */
+          b->sector = INVALID_SECTOR;
+        }
+      else
+        {
+          /* There is a waiter.  Give it the block. */
+          wake_waiters (b);
+        }
+      lock_release (&b->block_lock);
+
+      /* Try again. */
+      goto try_again;
+    }
+
+  /* Wait for cache contention to die down. */
+  lock_release (&cache_sync);
+  timer_msleep (1);
+  goto try_again;
+}
+
+/* Returns true if B's data has been read from disk or
+   written, that is, if cache_read() will not need to touch the
+   disk.  The caller must have a lock on B. */
+bool
+cache_up_to_date (struct cache_block *b)
+{
+  bool up_to_date;
+
+  lock_acquire (&b->data_lock);
+  up_to_date = b->up_to_date;
+  lock_release (&b->data_lock);
+
+  return up_to_date;
+}
+
+/* Bring block B up-to-date, by reading it from disk if
+   necessary, and return a pointer to its data.
+   The caller must have an exclusive or non-exclusive lock on
+   B. */
+void *
+cache_read (struct cache_block *b)
+{
+  lock_acquire (&b->data_lock);
+  if (!b->up_to_date)
+    {
+      block_read (fs_device, b->sector, b->data);
+      b->up_to_date = true;
+      b->dirty = false;
+    }
+  lock_release (&b->data_lock);
+
+  return b->data;
+}
+
+/* Zero out block B, without reading it from disk, and return a
+   pointer to the zeroed data.
+   The caller must have an exclusive lock on B. */
+void *
+cache_zero (struct cache_block *b)
+{
+  ASSERT (b->writers);
+  memset (b->data, 0, BLOCK_SECTOR_SIZE);
+  b->up_to_date = true;
+  b->dirty = true;
+
+  return b->data;
+}
+
+/* Marks block B as dirty, so that it will be written back to
+   disk before eviction.
+   The caller must have a read or write lock on B,
+   and B must be up-to-date. */
+void
+cache_dirty (struct cache_block *b)
+{
+  ASSERT (b->up_to_date);
+  b->dirty = true;
+}
+
+/* Unlocks block B.
+   If B is no longer locked by any thread, then it becomes a
+   candidate for immediate eviction. */
+void
+cache_unlock (struct cache_block *b)
+{
+  lock_acquire (&b->block_lock);
+  if (b->readers)
+    {
+      ASSERT (b->writers == 0);
+      b->readers--;
+    }
+  else
+    {
+      ASSERT (b->writers > 0);
+      b->writers--;
+    }
+  if (b->readers == 0 && b->writers == 0)
+    wake_waiters (b);
+  lock_release (&b->block_lock);
+}
+
+/* Evicts any of the CNT sectors starting at SECTOR that are in
+   the cache immediately, without writing them back to disk (even
+   if dirty).
+   The blocks must be entirely unused. */
+void
+cache_free (block_sector_t sector, size_t cnt)
+{
+  int i;
+
+  lock_acquire (&cache_sync);
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_block *b = &cache[i];
+
+      lock_acquire (&b->block_lock);
+      if (b->sector != INVALID_SECTOR
+          && b->sector >= sector && b->sector - sector < cnt)
+        {
+          /* Only invalidate the block if it's unused.  That
+             should be the normal case, but it could be part of
+             a read-ahead (in readahead_daemon()) or lookup (in
+             cache_lock()) that's in progress. */
+          if (b->readers == 0 && b->read_waiters == 0
+              && b->writers == 0 && b->write_waiters == 0)
+            b->sector = INVALID_SECTOR;
+        }
+      lock_release (&b->block_lock);
+    }
+  lock_release (&cache_sync);
+}
+
+/* Queues the CNT sectors starting at SECTOR to be read into the
+   cache in the background by the read-ahead daemon.  Drops the
+   request if too many are already pending or memory is short,
+   since read-ahead is only an optimization. */
+void
+cache_readahead (block_sector_t sector, size_t cnt)
+{
+  struct readahead_block *block;
+
+  if (!cache_readahead_enabled)
+    return;
+
+  lock_acquire (&readahead_lock);
+  if (readahead_cnt >= READAHEAD_MAX
+      || (block = malloc (sizeof *block)) == NULL)
+    {
+      lock_release (&readahead_lock);
+      return;
+    }
+  block->sector = sector;
+  block->cnt = cnt;
+  list_push_back (&readahead_list, &block->list_elem);
+  readahead_cnt++;
+  lock_release (&readahead_lock);
+
+  sema_up (&readahead_avail);
+}
+
+/* Reads as many of the CNT sectors starting at SECTOR into the
+   cache as possible with one transfer, stopping at the first
+   sector that is already cached.  Returns the number of sectors
+   processed, which is always at least 1. */
+static size_t
+readahead_run (block_sector_t sector, size_t cnt)
+{
+  struct cache_block *blocks[RUN_MAX];
+  size_t i, n;
+
+  ASSERT (cnt > 0 && cnt <= RUN_MAX);
+
+  /* Lock the blocks exclusively, so that anyone who wants to
+     read them waits for the transfer instead of starting their
+     own. */
+  for (n = 0; n < cnt; n++)
+    {
+      struct cache_block *b = cache_lock (sector + n, EXCLUSIVE);
+      if (cache_up_to_date (b))
+        {
+          cache_unlock (b);
+          break;
+        }
+      blocks[n] = b;
+    }
+  if (n == 0)
+    return 1;
+
+  block_read_multiple (fs_device, sector, n, readahead_buf);
+  for (i = 0; i < n; i++)
+    {
+      struct cache_block *b = blocks[i];
+
+      lock_acquire (&b->data_lock);
+      memcpy (b->data, readahead_buf + i * BLOCK_SECTOR_SIZE,
+              BLOCK_SECTOR_SIZE);
+      b->up_to_date = true;
+      b->dirty = false;
+      lock_release (&b->data_lock);
+      cache_unlock (b);
+    }
+  return n;
+}
+
+/* Read-ahead daemon.  Reads queued runs of sectors into the
+   cache, in the order they were requested. */
+static void
+readahead_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct readahead_block *ra_block;
+      block_sector_t sector;
+      size_t cnt;
+
+      sema_down (&readahead_avail);
+      lock_acquire (&readahead_lock);
+      ra_block = list_entry (list_pop_front (&readahead_list),
+                             struct readahead_block, list_elem);
+      readahead_cnt--;
+      lock_release (&readahead_lock);
+
+      sector = ra_block->sector;
+      cnt = ra_block->cnt;
+      free (ra_block);
+      while (cnt > 0)
+        {
+          size_t n = readahead_run (sector, cnt < RUN_MAX ? cnt : RUN_MAX);
+          sector += n;
+          cnt -= n;
+        }
+    }
+}
+
+/* Flush daemon.  Periodically writes dirty blocks back to disk,
+   so that writes are batched instead of going to disk one at a
+   time, yet are not held in memory indefinitely. */
+static void
+flush_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (FLUSH_TICKS);
+      flush_dirty (false);
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Sector number of a free cache block. */
+#define INVALID_SECTOR ((block_sector_t) -1)
+
+/* Type of lock to acquire on a cache block. */
+enum lock_type
+  {
+    NON_EXCLUSIVE,              /* Any number of lockers. */
+    EXCLUSIVE                   /* Only one locker. */
+  };
+
+/* If false, read-ahead requests are ignored.
+   Controlled by kernel command-line option "-no-readahead". */
+extern bool cache_readahead_enabled;
+
+void cache_init (void);
+void cache_flush (void);
+struct cache_block *cache_lock (block_sector_t, enum lock_type);
+bool cache_up_to_date (struct cache_block *);
+void *cache_read (struct cache_block *);
+void *cache_zero (struct cache_block *);
+void cache_dirty (struct cache_block *);
+void cache_unlock (struct cache_block *);
+void cache_free (block_sector_t, size_t cnt);
+void cache_readahead (block_sector_t, size_t cnt);
+
+#endif /* filesys/cache.h */
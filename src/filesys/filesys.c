@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
@@ -21,7 +22,10 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  file_init ();
+  dir_init ();
   free_map_init ();
 
   if (format) 
@@ -36,6 +40,15 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  cache_flush ();
+}
+
+/* Writes the free map and all dirty cached blocks to disk. */
+void
+filesys_sync (void)
+{
+  free_map_flush ();
+  cache_flush ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -48,7 +61,8 @@ filesys_create (const char *name, off_t initial_size)
   block_sector_t inode_sector = 0;
   struct dir *dir = dir_open_root ();
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && free_map_allocate (inode_get_inumber (dir_get_inode (dir)),
+                                        1, &inode_sector)
                   && inode_create (inode_sector, initial_size)
                   && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0) 
@@ -1,82 +1,413 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <limits.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* The free map is divided into groups of sectors, each of which
+   is described by one sector of the free map file.  A summary of
+   each group lets allocation skip groups that cannot satisfy a
+   request without looking at their bits, and records which
+   groups' bits need to be written back to the free map file. */
+#define GROUP_SECTORS (BLOCK_SECTOR_SIZE * CHAR_BIT)
+
+/* Summary of a group. */
+struct group
+  {
+    size_t free_cnt;            /* Number of free sectors. */
+    size_t largest;             /* Length of longest free run. */
+    size_t largest_start;       /* First sector of that run. */
+    size_t tail;                /* Free sectors at the end of the group. */
+    bool dirty;                 /* Bits changed since last written? */
+  };
+
+static struct group *groups;         /* One per group. */
+static size_t group_cnt;             /* Number of groups. */
+
+/* Protects free_map and groups. */
+static struct lock free_map_lock;
+
+/* Returns the first sector in group G. */
+static inline size_t
+group_start (size_t g)
+{
+  return g * GROUP_SECTORS;
+}
+
+/* Returns the sector just past the end of group G. */
+static inline size_t
+group_end (size_t g)
+{
+  size_t end = (g + 1) * GROUP_SECTORS;
+  size_t size = bitmap_size (free_map);
+  return end < size ? end : size;
+}
+
+/* Recomputes the longest free run and the free tail of group G
+   from its bits. */
+static void
+find_runs (size_t g)
+{
+  struct group *grp = &groups[g];
+  size_t start = group_start (g);
+  size_t end = group_end (g);
+  size_t free_start;
+
+  grp->largest = 0;
+  grp->largest_start = start;
+  grp->tail = 0;
+
+  /* Walk the free runs. */
+  free_start = bitmap_scan_range (free_map, start, end - start, 1, false);
+  while (free_start != BITMAP_ERROR)
+    {
+      size_t free_end = bitmap_scan_range (free_map, free_start,
+                                           end - free_start, 1, true);
+      if (free_end == BITMAP_ERROR)
+        free_end = end;
+
+      if (free_end - free_start > grp->largest)
+        {
+          grp->largest = free_end - free_start;
+          grp->largest_start = free_start;
+        }
+      if (free_end == end)
+        {
+          grp->tail = free_end - free_start;
+          break;
+        }
+      free_start = bitmap_scan_range (free_map, free_end, end - free_end,
+                                      1, false);
+    }
+}
+
+/* Recomputes the summary of group G from its bits. */
+static void
+update_group (size_t g)
+{
+  size_t start = group_start (g);
+
+  groups[g].free_cnt = bitmap_count (free_map, start,
+                                     group_end (g) - start, false);
+  find_runs (g);
+}
+
+/* Updates the summary of group G after sectors LO...HI-1 in it
+   have been set to VALUE, without rescanning the whole group
+   unless an allocation cut into its longest free run. */
+static void
+adjust_group (size_t g, size_t lo, size_t hi, bool value)
+{
+  struct group *grp = &groups[g];
+  size_t start = group_start (g);
+  size_t end = group_end (g);
+
+  if (value)
+    {
+      /* Allocated.  The free tail, if it was hit, now starts
+         after HI; the longest run must be looked for again. */
+      grp->free_cnt -= hi - lo;
+      if (hi > end - grp->tail)
+        grp->tail = end - hi;
+      if (lo < grp->largest_start + grp->largest && hi > grp->largest_start)
+        find_runs (g);
+    }
+  else
+    {
+      /* Released.  Only the free run that now contains LO...HI-1
+         can have become the longest or the tail. */
+      size_t run_start = lo;
+      size_t run_end;
+
+      grp->free_cnt += hi - lo;
+      while (run_start > start && !bitmap_test (free_map, run_start - 1))
+        run_start--;
+      run_end = bitmap_scan_range (free_map, hi, end - hi, 1, true);
+      if (run_end == BITMAP_ERROR)
+        run_end = end;
+
+      if (run_end - run_start > grp->largest)
+        {
+          grp->largest = run_end - run_start;
+          grp->largest_start = run_start;
+        }
+      if (run_end == end)
+        grp->tail = end - run_start;
+    }
+}
+
+/* Sets the CNT sectors starting at SECTOR, which must all be
+   !VALUE, to VALUE in the free map, and updates and marks dirty
+   the groups that they are in. */
+static void
+set_sectors (size_t sector, size_t cnt, bool value)
+{
+  size_t g;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+  ASSERT (!bitmap_contains (free_map, sector, cnt, value));
+
+  bitmap_set_multiple (free_map, sector, cnt, value);
+  for (g = sector / GROUP_SECTORS; g <= (sector + cnt - 1) / GROUP_SECTORS;
+       g++)
+    {
+      size_t lo = sector > group_start (g) ? sector : group_start (g);
+      size_t hi = sector + cnt < group_end (g) ? sector + cnt : group_end (g);
+
+      adjust_group (g, lo, hi, value);
+      groups[g].dirty = true;
+    }
+}
+
+/* Returns the first sector of a run of CNT free sectors that
+   starts at or after FROM within group G, or BITMAP_ERROR if
+   there is none.  The run may continue into later groups. */
+static size_t
+scan_group (size_t g, size_t from, size_t cnt)
+{
+  const struct group *grp = &groups[g];
+  size_t end = group_end (g);
+  size_t tail_start;
+
+  if (grp->free_cnt == 0)
+    return BITMAP_ERROR;
+
+  /* A run that fits within the group. */
+  if (grp->largest >= cnt)
+    {
+      return bitmap_scan_range (free_map, from, end - from, cnt, false);
+    }
+
+  /* A run that starts in the group's free tail and continues
+     into the following groups. */
+  tail_start = end - grp->tail;
+  if (tail_start < from)
+    tail_start = from;
+  if (grp->tail > 0 && tail_start < end
+      && cnt <= bitmap_size (free_map) - tail_start
+      && !bitmap_contains (free_map, tail_start, cnt, true))
+    return tail_start;
+
+  return BITMAP_ERROR;
+}
+
+/* Returns the first sector of a run of CNT free sectors at or
+   after GOAL, wrapping around to the start of the disk if
+   necessary, or BITMAP_ERROR if there is none. */
+static size_t
+find_run (size_t goal, size_t cnt)
+{
+  size_t first = goal / GROUP_SECTORS;
+  size_t i;
+
+  /* Visit GOAL's group starting from GOAL, then each following
+     group in turn, and finally the start of GOAL's group. */
+  for (i = 0; i <= group_cnt; i++)
+    {
+      size_t g = (first + i) % group_cnt;
+      size_t from = i == 0 ? goal : group_start (g);
+      size_t sector = scan_group (g, from, cnt);
+      if (sector != BITMAP_ERROR)
+        return sector;
+    }
+  return BITMAP_ERROR;
+}
+
 /* Initializes the free map. */
 void
-free_map_init (void) 
+free_map_init (void)
 {
+  size_t g;
+
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  groups = malloc (sizeof *groups * group_cnt);
+  if (groups == NULL)
+    PANIC ("free map summary allocation failed");
+  for (g = 0; g < group_cnt; g++)
+    {
+      update_group (g);
+      groups[g].dirty = true;
+    }
+  lock_init (&free_map_lock);
 }
 
-/* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+/* Allocates CNT consecutive sectors from the free map, as close
+   as possible after GOAL, and stores the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
-free_map_allocate (size_t cnt, block_sector_t *sectorp)
+free_map_allocate (block_sector_t goal, size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
-    {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
-    }
+  size_t sector;
+
+  lock_acquire (&free_map_lock);
+  if (goal >= bitmap_size (free_map))
+    goal = 0;
+  sector = find_run (goal, cnt);
+  if (sector != BITMAP_ERROR)
+    set_sectors (sector, cnt, true);
+  lock_release (&free_map_lock);
+
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates a run of up to CNT consecutive sectors, as close as
+   possible after GOAL, and stores the first sector into *SECTORP
+   and the number allocated into *CNTP.
+
+   If GOAL itself is free, the run starts there even if it is
+   shorter than CNT, so that a file can keep extending its last
+   extent.  Otherwise this takes the first run of CNT sectors at
+   or after GOAL, wrapping around to the start of the disk if
+   needed, and failing that the largest free run anywhere.
+
+   Returns true if successful, false if the disk is full. */
+bool
+free_map_allocate_near (block_sector_t goal, size_t cnt,
+                        block_sector_t *sectorp, size_t *cntp)
+{
+  size_t sector, run;
+
+  ASSERT (cnt > 0);
+
+  lock_acquire (&free_map_lock);
+  if (goal >= bitmap_size (free_map))
+    goal = 0;
+  if (bitmap_test (free_map, goal))
+    {
+      sector = find_run (goal, cnt);
+      if (sector != BITMAP_ERROR)
+        run = cnt;
+      else
+        {
+          /* No run of CNT free sectors: take the largest.  (Runs
+             that cross groups are not considered, so this might
+             not be quite the largest.) */
+          size_t g;
+
+          run = 0;
+          for (g = 0; g < group_cnt; g++)
+            if (groups[g].largest > run)
+              {
+                sector = groups[g].largest_start;
+                run = groups[g].largest;
+              }
+        }
+    }
+  else
+    {
+      size_t left = bitmap_size (free_map) - goal;
+      size_t end;
+
+      if (cnt > left)
+        cnt = left;
+      end = bitmap_scan_range (free_map, goal, cnt, 1, true);
+      sector = goal;
+      run = end != BITMAP_ERROR ? end - goal : cnt;
+    }
+
+  if (run > 0)
+    set_sectors (sector, run, true);
+  lock_release (&free_map_lock);
+
+  if (run == 0)
+    return false;
+  *sectorp = sector;
+  *cntp = run;
+  return true;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  set_sectors (sector, cnt, false);
+  lock_release (&free_map_lock);
+}
+
+/* Writes the parts of the free map that have changed since they
+   were last written to the free map file.  Each group occupies
+   one sector of the file, so this writes only the sectors that
+   changed. */
+void
+free_map_flush (void)
+{
+  size_t g;
+
+  if (free_map_file == NULL)
+    return;
+
+  lock_acquire (&free_map_lock);
+  for (g = 0; g < group_cnt; g++)
+    if (groups[g].dirty)
+      {
+        size_t start = group_start (g);
+        if (!bitmap_write_range (free_map, free_map_file,
+                                 start, group_end (g) - start))
+          PANIC ("can't write free map");
+        groups[g].dirty = false;
+      }
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
 void
-free_map_open (void) 
+free_map_open (void)
 {
+  size_t g;
+
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+
+  for (g = 0; g < group_cnt; g++)
+    {
+      update_group (g);
+      groups[g].dirty = false;
+    }
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
-free_map_close (void) 
+free_map_close (void)
 {
+  free_map_flush ();
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
    it. */
 void
-free_map_create (void) 
+free_map_create (void)
 {
   /* Create inode. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
+  /* Write bitmap to file.  Writing it allocates the file's data
+     blocks, which dirties the free map again, so the final
+     version is written by free_map_flush(). */
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
@@ -1,5 +1,6 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,6 +8,7 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
@@ -56,6 +58,44 @@ fsutil_cat (char **argv)
   file_close (file);
 }
 
+/* Reads file ARGV[1] sequentially, one sector-sized chunk at a
+   time as user programs like `cat' and `cp' do, and prints the
+   read throughput. */
+void
+fsutil_time_read (char **argv)
+{
+  const char *file_name = argv[1];
+
+  struct file *file;
+  char *buffer;
+  uint64_t start, elapsed;
+  off_t total = 0;
+
+  printf ("Timing sequential read of '%s'...\n", file_name);
+  file = filesys_open (file_name);
+  if (file == NULL)
+    PANIC ("%s: open failed", file_name);
+  buffer = palloc_get_page (PAL_ASSERT);
+
+  start = timer_nsec ();
+  for (;;)
+    {
+      off_t n = file_read (file, buffer, BLOCK_SECTOR_SIZE);
+      if (n == 0)
+        break;
+      total += n;
+    }
+  elapsed = timer_nsec () - start;
+
+  printf ("Read %'"PROTd" bytes in %'"PRIu64" us", total, elapsed / 1000);
+  if (elapsed > 0)
+    printf (" (%'"PRIu64" kB/s)", (uint64_t) total * 1000000 / elapsed);
+  printf (".\n");
+
+  palloc_free_page (buffer);
+  file_close (file);
+}
+
 /* Deletes file ARGV[1]. */
 void
 fsutil_rm (char **argv) 
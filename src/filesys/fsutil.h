@@ -3,6 +3,7 @@
 
 void fsutil_ls (char **argv);
 void fsutil_cat (char **argv);
+void fsutil_time_read (char **argv);
 void fsutil_rm (char **argv);
 void fsutil_extract (char **argv);
 void fsutil_append (char **argv);
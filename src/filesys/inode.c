@@ -2,31 +2,63 @@
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stdint.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Sector that isn't a block.  Sector 0 holds the free map's
+   inode, so it is never part of a file's data. */
+#define NO_SECTOR 0
+
+/* A run of sectors that are consecutive both within a file and
+   on disk. */
+struct extent
+  {
+    block_sector_t file_sector;         /* First sector within file. */
+    block_sector_t start;               /* First sector on disk. */
+    block_sector_t cnt;                 /* Number of sectors. */
+  };
+
+/* Number of extents stored in the inode itself and in each
+   overflow block. */
+#define INODE_EXTENT_CNT 40
+#define OVERFLOW_EXTENT_CNT 42
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   A file's data is described by a list of extents sorted by
+   file_sector.  Parts of the file not covered by any extent are
+   holes, which read as zeros and are allocated when first
+   written.  Extents that don't fit in the inode continue in a
+   chain of overflow blocks, so the number of extents is limited
+   only by the size of the disk. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    struct extent extents[INODE_EXTENT_CNT]; /* First extents. */
+    block_sector_t overflow;            /* First overflow block. */
+    uint32_t extent_cnt;                /* Total number of extents. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t unused[4];                 /* Not used. */
   };
 
-/* Returns the number of sectors to allocate for an inode SIZE
-   bytes long. */
-static inline size_t
-bytes_to_sectors (off_t size)
-{
-  return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
-}
+/* Overflow block.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct overflow_block
+  {
+    struct extent extents[OVERFLOW_EXTENT_CNT]; /* Further extents. */
+    block_sector_t next;                /* Next overflow block. */
+    uint32_t unused[1];                 /* Not used. */
+  };
 
 /* In-memory inode. */
 struct inode 
@@ -36,73 +68,453 @@ struct inode
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
-    struct inode_disk data;             /* Inode content. */
+
+    /* Inode content, with all of the extents in one array.
+       Extending the file or filling in a hole modifies these,
+       so they are protected by LOCK. */
+    struct lock lock;                   /* Protects members in group. */
+    off_t length;                       /* File size in bytes. */
+    struct extent *extents;             /* Extents, sorted by file_sector. */
+    size_t extent_cnt;                  /* Number of extents. */
+    size_t extent_cap;                  /* Number of elements in EXTENTS. */
+    block_sector_t *overflow;           /* Chain of overflow blocks. */
+    size_t overflow_cnt;                /* Number of overflow blocks. */
+
+    /* Sequential read detection, for read-ahead.  These are only
+       heuristics, so they are not synchronized. */
+    off_t ra_next;                      /* Offset just past the last read. */
+    off_t ra_end;                       /* Read-ahead issued up to here. */
+    int ra_window;                      /* Sectors to read ahead, 0 if random. */
   };
 
+/* Bounds on the read-ahead window, in sectors. */
+#define RA_WINDOW_MIN 2
+#define RA_WINDOW_MAX 32
+
+static void inode_readahead (struct inode *, off_t offset, off_t size,
+                             bool hit);
+
+/* Returns the number of overflow blocks that INODE needs to
+   hold EXTENT_CNT extents. */
+static size_t
+overflow_blocks_needed (size_t extent_cnt)
+{
+  if (extent_cnt <= INODE_EXTENT_CNT)
+    return 0;
+  return DIV_ROUND_UP (extent_cnt - INODE_EXTENT_CNT, OVERFLOW_EXTENT_CNT);
+}
+
+/* Writes INODE's length and extent list back to the buffer
+   cache.  Of the overflow blocks, only those holding extent
+   FIRST or later are written, since earlier extents have not
+   changed, and those past the last extent are left alone.
+   INODE's lock must be held, unless it is not yet visible to
+   other threads. */
+static void
+write_disk_inode (struct inode *inode, size_t first)
+{
+  struct cache_block *block;
+  struct inode_disk *disk_inode;
+  struct overflow_block *ob;
+  size_t i;
+
+  block = cache_lock (inode->sector, EXCLUSIVE);
+  disk_inode = cache_zero (block);
+  memcpy (disk_inode->extents, inode->extents,
+          sizeof *inode->extents * (inode->extent_cnt < INODE_EXTENT_CNT
+                                    ? inode->extent_cnt : INODE_EXTENT_CNT));
+  disk_inode->overflow = (inode->overflow_cnt > 0
+                          ? inode->overflow[0] : NO_SECTOR);
+  disk_inode->extent_cnt = inode->extent_cnt;
+  disk_inode->length = inode->length;
+  disk_inode->magic = INODE_MAGIC;
+  cache_dirty (block);
+  cache_unlock (block);
+
+  for (i = 0; i < overflow_blocks_needed (inode->extent_cnt); i++)
+    {
+      size_t ofs = INODE_EXTENT_CNT + i * OVERFLOW_EXTENT_CNT;
+      size_t cnt = (inode->extent_cnt - ofs < OVERFLOW_EXTENT_CNT
+                    ? inode->extent_cnt - ofs : OVERFLOW_EXTENT_CNT);
+
+      if (ofs + OVERFLOW_EXTENT_CNT <= first)
+        continue;
+
+      block = cache_lock (inode->overflow[i], EXCLUSIVE);
+      ob = cache_zero (block);
+      memcpy (ob->extents, inode->extents + ofs, sizeof *inode->extents * cnt);
+      ob->next = (i + 1 < inode->overflow_cnt
+                  ? inode->overflow[i + 1] : NO_SECTOR);
+      cache_dirty (block);
+      cache_unlock (block);
+    }
+}
+
+/* Appends SECTOR to INODE's in-memory chain of overflow
+   blocks.  Returns false if memory allocation fails. */
+static bool
+push_overflow (struct inode *inode, block_sector_t sector)
+{
+  block_sector_t *new_overflow;
+
+  new_overflow = realloc (inode->overflow,
+                          sizeof *new_overflow * (inode->overflow_cnt + 1));
+  if (new_overflow == NULL)
+    return false;
+  inode->overflow = new_overflow;
+  inode->overflow[inode->overflow_cnt++] = sector;
+  return true;
+}
+
+/* Reads INODE's length and extent list from its on-disk inode,
+   following the whole chain of overflow blocks.  Returns false
+   if memory allocation fails. */
+static bool
+read_disk_inode (struct inode *inode)
+{
+  struct cache_block *block;
+  struct inode_disk *disk_inode;
+  block_sector_t next;
+  size_t i;
+
+  block = cache_lock (inode->sector, NON_EXCLUSIVE);
+  disk_inode = cache_read (block);
+  inode->length = disk_inode->length;
+  inode->extent_cnt = disk_inode->extent_cnt;
+  inode->extent_cap = inode->extent_cnt > 8 ? inode->extent_cnt : 8;
+  inode->extents = malloc (sizeof *inode->extents * inode->extent_cap);
+  inode->overflow = NULL;
+  inode->overflow_cnt = 0;
+  if (inode->extents != NULL)
+    memcpy (inode->extents, disk_inode->extents,
+            sizeof *inode->extents * (inode->extent_cnt < INODE_EXTENT_CNT
+                                      ? inode->extent_cnt
+                                      : INODE_EXTENT_CNT));
+  next = disk_inode->overflow;
+  cache_unlock (block);
+  if (inode->extents == NULL)
+    return false;
+
+  for (i = 0; next != NO_SECTOR; i++)
+    {
+      const struct overflow_block *ob;
+      size_t ofs = INODE_EXTENT_CNT + i * OVERFLOW_EXTENT_CNT;
+
+      if (!push_overflow (inode, next))
+        {
+          free (inode->overflow);
+          free (inode->extents);
+          return false;
+        }
+
+      block = cache_lock (next, NON_EXCLUSIVE);
+      ob = cache_read (block);
+      if (ofs < inode->extent_cnt)
+        memcpy (inode->extents + ofs, ob->extents,
+                sizeof *inode->extents
+                * (inode->extent_cnt - ofs < OVERFLOW_EXTENT_CNT
+                   ? inode->extent_cnt - ofs : OVERFLOW_EXTENT_CNT));
+      next = ob->next;
+      cache_unlock (block);
+    }
+  return true;
+}
+
+/* Returns the index of the last of INODE's extents that starts
+   at or before FILE_SECTOR, or -1 if there is none.  INODE's
+   lock must be held. */
+static int
+find_extent (const struct inode *inode, block_sector_t file_sector)
+{
+  size_t lo = 0, hi = inode->extent_cnt;
+
+  /* Binary search for the first extent that starts after
+     FILE_SECTOR. */
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (inode->extents[mid].file_sector <= file_sector)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return (int) lo - 1;
+}
+
+/* Finds the data for sector FILE_SECTOR within INODE.  Returns
+   the disk sector that holds it, or NO_SECTOR if FILE_SECTOR is
+   in a hole, and stores in *CNTP the number of sectors from
+   FILE_SECTOR to the end of its extent or hole (or a very large
+   number for the hole past the last extent).  INODE's lock must
+   be held. */
+static block_sector_t
+lookup_run (const struct inode *inode, block_sector_t file_sector,
+            size_t *cntp)
+{
+  int idx = find_extent (inode, file_sector);
+
+  if (idx >= 0)
+    {
+      const struct extent *e = &inode->extents[idx];
+      if (file_sector - e->file_sector < e->cnt)
+        {
+          *cntp = e->cnt - (file_sector - e->file_sector);
+          return e->start + (file_sector - e->file_sector);
+        }
+    }
+
+  if ((size_t) (idx + 1) < inode->extent_cnt)
+    *cntp = inode->extents[idx + 1].file_sector - file_sector;
+  else
+    *cntp = SIZE_MAX;
+  return NO_SECTOR;
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
+   within INODE, or NO_SECTOR if POS lies in a hole.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
+  block_sector_t sector = -1;
+  size_t cnt;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+  lock_acquire (&inode->lock);
+  if (pos < inode->length)
+    sector = lookup_run (inode, pos / BLOCK_SECTOR_SIZE, &cnt);
+  lock_release (&inode->lock);
+  return sector;
+}
+
+/* Makes room in INODE for one more extent, growing the in-memory
+   array and appending a block to the overflow chain as needed.
+   Returns false if memory or disk allocation fails.  INODE's
+   lock must be held. */
+static bool
+reserve_extent (struct inode *inode)
+{
+  struct cache_block *block;
+  struct overflow_block *ob;
+  block_sector_t sector;
+
+  if (inode->extent_cnt >= inode->extent_cap)
+    {
+      size_t new_cap = inode->extent_cap * 2;
+      struct extent *new_extents;
+
+      new_extents = realloc (inode->extents, sizeof *new_extents * new_cap);
+      if (new_extents == NULL)
+        return false;
+      inode->extents = new_extents;
+      inode->extent_cap = new_cap;
+    }
+
+  if (overflow_blocks_needed (inode->extent_cnt + 1) <= inode->overflow_cnt)
+    return true;
+
+  /* Start a new overflow block at the end of the chain.  It is
+     empty until write_disk_inode() fills it in, so only the
+     previous block's link needs to be updated here; the inode
+     itself points to the first block. */
+  if (!free_map_allocate (inode->sector, 1, &sector))
+    return false;
+  if (!push_overflow (inode, sector))
+    {
+      free_map_release (sector, 1);
+      return false;
+    }
+
+  block = cache_lock (sector, EXCLUSIVE);
+  ob = cache_zero (block);
+  ob->next = NO_SECTOR;
+  cache_unlock (block);
+
+  if (inode->overflow_cnt > 1)
+    {
+      block = cache_lock (inode->overflow[inode->overflow_cnt - 2], EXCLUSIVE);
+      ob = cache_read (block);
+      ob->next = sector;
+      cache_dirty (block);
+      cache_unlock (block);
+    }
+  return true;
+}
+
+/* Allocates disk blocks for the hole in INODE that a write of
+   SIZE bytes at OFFSET starts in, up to the end of the write, and
+   adds them to its extent list, merging with the neighboring
+   extents where they are contiguous.  The new blocks are placed
+   right after the previous extent if possible.  Stores the first
+   new block into *SECTORP and the number allocated into *CNTP.
+
+   New blocks that the write only partly covers are zeroed in the
+   buffer cache, and so are any that lie inside the file, where a
+   reader could see them before the write reaches them.  The rest
+   are about to be overwritten in full and lie past the end of
+   file, which is only extended after the data is written, so
+   they are left alone.  Returns false if the disk or the extent
+   list is full.  INODE's lock must be held. */
+static bool
+fill_hole (struct inode *inode, off_t offset, off_t size,
+           block_sector_t *sectorp, size_t *cntp)
+{
+  block_sector_t file_sector = offset / BLOCK_SECTOR_SIZE;
+  size_t cnt = DIV_ROUND_UP (offset + size, BLOCK_SECTOR_SIZE) - file_sector;
+  int idx = find_extent (inode, file_sector);
+  struct extent *prev = idx >= 0 ? &inode->extents[idx] : NULL;
+  struct extent *next = ((size_t) (idx + 1) < inode->extent_cnt
+                         ? &inode->extents[idx + 1] : NULL);
+  block_sector_t goal, start;
+  size_t got, first, i;
+
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+  ASSERT (prev == NULL || file_sector - prev->file_sector >= prev->cnt);
+
+  /* Don't overlap the next extent. */
+  if (next != NULL && next->file_sector - file_sector < cnt)
+    cnt = next->file_sector - file_sector;
+
+  goal = prev != NULL ? prev->start + prev->cnt : inode->sector + 1;
+  if (!free_map_allocate_near (goal, cnt, &start, &got))
+    return false;
+
+  if (prev != NULL && prev->file_sector + prev->cnt == file_sector
+      && prev->start + prev->cnt == start)
+    {
+      /* Extend the previous extent, and absorb the next one too
+         if that closes the gap between them. */
+      prev->cnt += got;
+      if (next != NULL && prev->file_sector + prev->cnt == next->file_sector
+          && prev->start + prev->cnt == next->start)
+        {
+          prev->cnt += next->cnt;
+          memmove (next, next + 1,
+                   sizeof *next * (inode->extent_cnt - (idx + 2)));
+          inode->extent_cnt--;
+        }
+      first = idx;
+    }
+  else if (next != NULL && file_sector + got == next->file_sector
+           && start + got == next->start)
+    {
+      /* Extend the next extent backward. */
+      next->file_sector = file_sector;
+      next->start = start;
+      next->cnt += got;
+      first = idx + 1;
+    }
   else
-    return -1;
+    {
+      /* Insert a new extent. */
+      struct extent *e;
+
+      if (!reserve_extent (inode))
+        {
+          free_map_release (start, got);
+          return false;
+        }
+      first = idx + 1;
+      e = &inode->extents[first];
+      memmove (e + 1, e, sizeof *e * (inode->extent_cnt - first));
+      e->file_sector = file_sector;
+      e->start = start;
+      e->cnt = got;
+      inode->extent_cnt++;
+    }
+
+  for (i = 0; i < got; i++)
+    {
+      off_t ofs = (off_t) (file_sector + i) * BLOCK_SECTOR_SIZE;
+      if (ofs < offset || ofs + BLOCK_SECTOR_SIZE > offset + size
+          || ofs < inode->length)
+        {
+          struct cache_block *block = cache_lock (start + i, EXCLUSIVE);
+          cache_zero (block);
+          cache_unlock (block);
+        }
+    }
+
+  write_disk_inode (inode, first);
+  *sectorp = start;
+  *cntp = got;
+  return true;
+}
+
+/* Frees INODE's data and overflow blocks, and INODE itself. */
+static void
+deallocate_inode (struct inode *inode)
+{
+  size_t i;
+
+  /* Drop the cached copies, so that their stale contents are
+     never written back over the sectors after they are
+     reallocated. */
+  for (i = 0; i < inode->extent_cnt; i++)
+    {
+      struct extent *e = &inode->extents[i];
+      cache_free (e->start, e->cnt);
+      free_map_release (e->start, e->cnt);
+    }
+  for (i = 0; i < inode->overflow_cnt; i++)
+    {
+      cache_free (inode->overflow[i], 1);
+      free_map_release (inode->overflow[i], 1);
+    }
+  cache_free (inode->sector, 1);
+  free_map_release (inode->sector, 1);
 }
 
 /* List of open inodes, so that opening a single inode twice
    returns the same `struct inode'. */
 static struct list open_inodes;
 
+/* Cache of struct inode. */
+static struct kmem_cache *inode_cache;
+
+/* Constructor for inode_cache objects. */
+static void
+inode_ctor (void *inode_)
+{
+  struct inode *inode = inode_;
+  lock_init (&inode->lock);
+}
+
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
   list_init (&open_inodes);
+  inode_cache = kmem_cache_create ("inode", sizeof (struct inode), inode_ctor);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
-   Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   device.  The data is initially one big hole, so no data
+   blocks are allocated until they are written.
+   Returns true if successful. */
 bool
 inode_create (block_sector_t sector, off_t length)
 {
-  struct inode_disk *disk_inode = NULL;
-  bool success = false;
+  struct inode_disk *disk_inode;
+  struct cache_block *block;
 
   ASSERT (length >= 0);
 
   /* If this assertion fails, the inode structure is not exactly
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct overflow_block) == BLOCK_SECTOR_SIZE);
 
-  disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
-    {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
-      free (disk_inode);
-    }
-  return success;
+  block = cache_lock (sector, EXCLUSIVE);
+  disk_inode = cache_zero (block);
+  disk_inode->length = length;
+  disk_inode->magic = INODE_MAGIC;
+  cache_dirty (block);
+  cache_unlock (block);
+
+  return true;
 }
 
 /* Reads an inode from SECTOR
@@ -127,7 +539,7 @@ inode_open (block_sector_t sector)
     }
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = kmem_cache_alloc (inode_cache);
   if (inode == NULL)
     return NULL;
 
@@ -137,7 +549,15 @@ inode_open (block_sector_t sector)
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->ra_next = 0;
+  inode->ra_end = 0;
+  inode->ra_window = 0;
+  if (!read_disk_inode (inode))
+    {
+      list_remove (&inode->elem);
+      kmem_cache_free (inode_cache, inode);
+      return NULL;
+    }
   return inode;
 }
 
@@ -175,13 +595,11 @@ inode_close (struct inode *inode)
  
       /* Deallocate blocks if removed. */
       if (inode->removed) 
-        {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
-        }
+        deallocate_inode (inode);
 
-      free (inode); 
+      free (inode->extents);
+      free (inode->overflow);
+      kmem_cache_free (inode_cache, inode);
     }
 }
 
@@ -202,7 +620,8 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  off_t start = offset;
+  bool hit = true;
 
   while (size > 0) 
     {
@@ -217,50 +636,114 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 
       /* Number of bytes to actually copy out of this sector. */
       int chunk_size = size < min_left ? size : min_left;
+      struct cache_block *block;
+
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (sector_idx == NO_SECTOR)
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
+          /* A hole reads as zeros. */
+          memset (buffer + bytes_read, 0, chunk_size);
         }
-      else 
+      else
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          /* Copy the chunk out of the cached sector. */
+          block = cache_lock (sector_idx, NON_EXCLUSIVE);
+          hit = hit && cache_up_to_date (block);
+          memcpy (buffer + bytes_read,
+                  (uint8_t *) cache_read (block) + sector_ofs, chunk_size);
+          cache_unlock (block);
         }
-      
+
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+
+  if (bytes_read > 0)
+    inode_readahead (inode, start, bytes_read, hit);
 
   return bytes_read;
 }
 
+/* Updates INODE's sequential access detection after a read of
+   SIZE bytes at OFFSET, and queues read-ahead of the sectors
+   that follow if reads are sequential.  HIT is true if every
+   sector read was already in the cache.
+
+   The read-ahead window starts small once two consecutive reads
+   are sequential.  It doubles each time a read finds all of its
+   sectors already cached, meaning that read-ahead is paying
+   off, and halves on a miss, which means that read-ahead fell
+   behind or its blocks were evicted before use.  A
+   non-sequential read turns read-ahead off.
+
+   The part of each extent that falls in the window is queued as
+   a single run, so that it can be read with multi-sector
+   transfers. */
+static void
+inode_readahead (struct inode *inode, off_t offset, off_t size, bool hit)
+{
+  off_t end = offset + size;
+  off_t ra_limit, pos;
+
+  if (offset != inode->ra_next)
+    {
+      inode->ra_next = end;
+      inode->ra_end = 0;
+      inode->ra_window = 0;
+      return;
+    }
+  inode->ra_next = end;
+
+  if (inode->ra_window == 0)
+    inode->ra_window = RA_WINDOW_MIN;
+  else if (hit)
+    inode->ra_window = (inode->ra_window * 2 < RA_WINDOW_MAX
+                        ? inode->ra_window * 2 : RA_WINDOW_MAX);
+  else
+    inode->ra_window = (inode->ra_window / 2 > RA_WINDOW_MIN
+                        ? inode->ra_window / 2 : RA_WINDOW_MIN);
+
+  /* Queue the sectors in the window that haven't been queued
+     already. */
+  ra_limit = end + inode->ra_window * BLOCK_SECTOR_SIZE;
+  if (ra_limit > inode_length (inode))
+    ra_limit = inode_length (inode);
+  pos = ROUND_UP (end, BLOCK_SECTOR_SIZE);
+  if (pos < inode->ra_end)
+    pos = inode->ra_end;
+  lock_acquire (&inode->lock);
+  while (pos < ra_limit)
+    {
+      size_t want = DIV_ROUND_UP (ra_limit - pos, BLOCK_SECTOR_SIZE);
+      size_t cnt;
+      block_sector_t sector = lookup_run (inode, pos / BLOCK_SECTOR_SIZE,
+                                          &cnt);
+      if (cnt > want)
+        cnt = want;
+      if (sector != NO_SECTOR)
+        cache_readahead (sector, cnt);
+      pos += cnt * BLOCK_SECTOR_SIZE;
+    }
+  lock_release (&inode->lock);
+  if (pos > inode->ra_end)
+    inode->ra_end = pos;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up.  A write past end of file extends the
+   inode; any gap between the old end of file and OFFSET becomes
+   a hole. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
   if (inode->deny_write_cnt)
     return 0;
@@ -268,51 +751,64 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t file_sector = offset / BLOCK_SECTOR_SIZE;
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      size_t cnt;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Bytes left in sector. */
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
 
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
-
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      int chunk_size = size < sector_left ? size : sector_left;
+      struct cache_block *block;
+      uint8_t *sector_data;
+
+      /* Find the sector, allocating blocks for the rest of the
+         write at once if it falls in a hole, so that the file
+         gets one long extent instead of many short ones. */
+      lock_acquire (&inode->lock);
+      sector_idx = lookup_run (inode, file_sector, &cnt);
+      if (sector_idx == NO_SECTOR)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
+          if (!fill_hole (inode, offset, size, &sector_idx, &cnt))
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              lock_release (&inode->lock);
+              break;
             }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
         }
+      lock_release (&inode->lock);
+
+      /* If the sector contains data before or after the chunk
+         we're writing, then we need to read in the sector
+         first.  Otherwise we start with a sector of all zeros. */
+      block = cache_lock (sector_idx, EXCLUSIVE);
+      if (sector_ofs > 0 || chunk_size < sector_left)
+        sector_data = cache_read (block);
+      else
+        sector_data = cache_zero (block);
+      memcpy (sector_data + sector_ofs, buffer + bytes_written, chunk_size);
+      cache_dirty (block);
+      cache_unlock (block);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /* Extend the file only after the data is in place, so that
+     readers never see the new length before the new data. */
+  if (bytes_written > 0)
+    {
+      lock_acquire (&inode->lock);
+      if (offset > inode->length)
+        {
+          inode->length = offset;
+          write_disk_inode (inode, inode->extent_cnt);
+        }
+      lock_release (&inode->lock);
+    }
 
   return bytes_written;
 }
@@ -341,5 +837,5 @@ inode_allow_write (struct inode *inode)
 off_t
 inode_length (const struct inode *inode)
 {
-  return inode->data.length;
+  return inode->length;
 }
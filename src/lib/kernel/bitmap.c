@@ -68,6 +68,48 @@ last_mask (const struct bitmap *b)
   int last_bits = b->bit_cnt % ELEM_BITS;
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns a bit mask in which the bits of element ELEM_IDX that
+   represent bits START through END - 1 of the bitmap are set to
+   1 and the rest are set to 0.  The range must overlap the
+   element. */
+static inline elem_type
+range_mask (size_t elem_idx, size_t start, size_t end) 
+{
+  size_t first = elem_idx * ELEM_BITS;
+  elem_type mask = (elem_type) -1;
+
+  if (start > first)
+    mask &= (elem_type) -1 << (start - first);
+  if (end < first + ELEM_BITS)
+    mask &= ((elem_type) 1 << (end - first)) - 1;
+  return mask;
+}
+
+/* Returns the position of the least significant 1-bit in
+   ELEM, which must be nonzero. */
+static inline unsigned
+first_set_bit (elem_type elem) 
+{
+  elem_type bit;
+
+  /* See [IA32-v2a] "BSF". */
+  asm ("bsfl %1, %0" : "=r" (bit) : "rm" (elem) : "cc");
+  return bit;
+}
+
+/* Returns the number of 1-bits in ELEM.  The i686 has no POPCNT
+   instruction, so this adds up the bits in parallel: first in
+   pairs, then in nibbles, then in bytes, then sums the bytes
+   with a multiply.  Assumes that elem_type is 32 bits wide. */
+static inline unsigned
+popcount (elem_type elem) 
+{
+  elem = elem - ((elem >> 1) & 0x55555555);
+  elem = (elem & 0x33333333) + ((elem >> 2) & 0x33333333);
+  elem = (elem + (elem >> 4)) & 0x0f0f0f0f;
+  return (elem * 0x01010101) >> 24;
+}
 
 /* Creation and destruction. */
 
@@ -213,18 +255,32 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element is updated atomically, but the update as a whole
+   is not atomic. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  size_t end = start + cnt;
   size_t i;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  if (cnt == 0)
+    return;
+  for (i = elem_idx (start); i <= elem_idx (end - 1); i++)
+    {
+      elem_type mask = range_mask (i, start, end);
+
+      /* Atomic for the same reasons as in bitmap_mark() and
+         bitmap_reset(). */
+      if (value)
+        asm ("orl %1, %0" : "+m" (b->bits[i]) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "+m" (b->bits[i]) : "r" (~mask) : "cc");
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,17 +288,19 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t end = start + cnt;
+  size_t i, true_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
-  return value_cnt;
+  if (cnt == 0)
+    return 0;
+  true_cnt = 0;
+  for (i = elem_idx (start); i <= elem_idx (end - 1); i++)
+    true_cnt += popcount (b->bits[i] & range_mask (i, start, end));
+  return value ? true_cnt : cnt - true_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -250,14 +308,18 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t end = start + cnt;
   size_t i;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
+  if (cnt == 0)
+    return false;
+  for (i = elem_idx (start); i <= elem_idx (end - 1); i++)
+    if (((b->bits[i] ^ flip) & range_mask (i, start, end)) != 0)
       return true;
   return false;
 }
@@ -288,6 +350,33 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 
 /* Finding set or unset bits. */
 
+/* Returns the index of the first bit in B at or after START and
+   before END that is set to VALUE, or END if there is none.
+   Skips whole elements that contain no such bit, then uses BSF
+   to find the bit within an element. */
+static size_t
+find_next (const struct bitmap *b, size_t start, size_t end, bool value) 
+{
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t i, last;
+  elem_type elem;
+
+  ASSERT (end <= b->bit_cnt);
+
+  if (start >= end)
+    return end;
+  i = elem_idx (start);
+  last = elem_idx (end - 1);
+  elem = (b->bits[i] ^ flip) & range_mask (i, start, end);
+  while (elem == 0)
+    {
+      if (++i > last)
+        return end;
+      elem = (b->bits[i] ^ flip) & range_mask (i, start, end);
+    }
+  return i * ELEM_BITS + first_set_bit (elem);
+}
+
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
@@ -298,13 +387,43 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
+  return bitmap_scan_range (b, start, b->bit_cnt - start, cnt, value);
+}
+
+/* Finds and returns the starting index of the first group of CNT
+   consecutive bits in B that are all set to VALUE and lie within
+   the BIT_CNT bits starting at START.
+   If there is no such group, returns BITMAP_ERROR. */
+size_t
+bitmap_scan_range (const struct bitmap *b, size_t start, size_t bit_cnt,
+                   size_t cnt, bool value) 
+{
+  ASSERT (b != NULL);
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (bit_cnt <= b->bit_cnt - start);
+
+  if (cnt == 0)
+    return start;
+  if (cnt <= bit_cnt) 
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t last = start + bit_cnt - cnt;
+      size_t i = start;
+
+      /* Jump to the next bit set to VALUE, then to the next bit
+         not set to VALUE, which ends the run.  Either the run is
+         long enough or the search resumes after it. */
+      while (i <= last)
+        {
+          size_t run_end;
+
+          i = find_next (b, i, last + 1, value);
+          if (i > last)
+            break;
+          run_end = find_next (b, i, i + cnt, !value);
+          if (run_end == i + cnt)
+            return i;
+          i = run_end;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -358,6 +477,25 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the CNT bits starting at START in B to the same place
+   in FILE, rounded out to whole bytes.  START must be a multiple
+   of CHAR_BIT.  Return true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  off_t ofs, size;
+
+  ASSERT (start % CHAR_BIT == 0);
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (start + cnt <= b->bit_cnt);
+
+  ofs = start / CHAR_BIT;
+  size = DIV_ROUND_UP (cnt, CHAR_BIT);
+  return file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+          == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
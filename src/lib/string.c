@@ -1,5 +1,41 @@
 #include <string.h>
 #include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* The block operations below work a 32-bit word at a time once
+   their pointers are word-aligned, copying and filling with the
+   x86 string instructions and scanning with the classic
+   "has a zero byte" test.  Word-aligned loads never cross a page
+   boundary, so reading a whole word that extends past the end of
+   a string or block cannot fault when its first byte would not.
+   Short operations, which are not worth the setup, and the
+   unaligned ends of long ones are done a byte at a time. */
+
+/* A word, which may alias any other type. */
+typedef uint32_t __attribute__ ((may_alias)) word_t;
+
+/* Operations shorter than this are done a byte at a time. */
+#define WORD_MIN 16
+
+/* A word with each byte set to 0x01, and one with each byte set
+   to 0x80. */
+#define ONES ((word_t) 0x01010101)
+#define HIGHS ((word_t) 0x80808080)
+
+/* Returns nonzero if any byte of W is zero. */
+static inline word_t
+has_zero_byte (word_t w)
+{
+  return (w - ONES) & ~w & HIGHS;
+}
+
+/* Returns true if P is word-aligned. */
+static inline bool
+is_aligned (const void *p)
+{
+  return ((uintptr_t) p & (sizeof (word_t) - 1)) == 0;
+}
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -12,6 +48,26 @@ memcpy (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
+  if (size >= WORD_MIN)
+    {
+      size_t word_cnt;
+
+      /* Align DST.  SRC may still be unaligned, which costs a
+         little on x86 but is allowed. */
+      while (!is_aligned (dst))
+        {
+          *dst++ = *src++;
+          size--;
+        }
+
+      /* Copy whole words. */
+      word_cnt = size / sizeof (word_t);
+      asm volatile ("rep movsl"
+                    : "+D" (dst), "+S" (src), "+c" (word_cnt)
+                    : : "memory");
+      size %= sizeof (word_t);
+    }
+
   while (size-- > 0)
     *dst++ = *src++;
 
@@ -58,6 +114,20 @@ memcmp (const void *a_, const void *b_, size_t size)
   ASSERT (a != NULL || size == 0);
   ASSERT (b != NULL || size == 0);
 
+  /* If A and B can be aligned together, skip over equal words.
+     The byte loop below then finds the differing byte, if any. */
+  if (size >= WORD_MIN
+      && ((uintptr_t) a ^ (uintptr_t) b) % sizeof (word_t) == 0)
+    {
+      for (; !is_aligned (a); a++, b++, size--)
+        if (*a != *b)
+          return *a > *b ? +1 : -1;
+      for (; size >= sizeof (word_t); a += sizeof (word_t),
+             b += sizeof (word_t), size -= sizeof (word_t))
+        if (*(const word_t *) a != *(const word_t *) b)
+          break;
+    }
+
   for (; size-- > 0; a++, b++)
     if (*a != *b)
       return *a > *b ? +1 : -1;
@@ -98,6 +168,21 @@ memchr (const void *block_, int ch_, size_t size)
 
   ASSERT (block != NULL || size == 0);
 
+  if (size >= WORD_MIN)
+    {
+      word_t pattern = ch * ONES;
+
+      for (; !is_aligned (block); block++, size--)
+        if (*block == ch)
+          return (void *) block;
+
+      /* Skip words that do not contain CH. */
+      for (; size >= sizeof (word_t);
+           block += sizeof (word_t), size -= sizeof (word_t))
+        if (has_zero_byte (*(const word_t *) block ^ pattern))
+          break;
+    }
+
   for (; size-- > 0; block++)
     if (*block == ch)
       return (void *) block;
@@ -281,7 +366,26 @@ memset (void *dst_, int value, size_t size)
   unsigned char *dst = dst_;
 
   ASSERT (dst != NULL || size == 0);
-  
+
+  if (size >= WORD_MIN)
+    {
+      word_t word = (unsigned char) value * ONES;
+      size_t word_cnt;
+
+      while (!is_aligned (dst))
+        {
+          *dst++ = value;
+          size--;
+        }
+
+      word_cnt = size / sizeof (word_t);
+      asm volatile ("rep stosl"
+                    : "+D" (dst), "+c" (word_cnt)
+                    : "a" (word)
+                    : "memory");
+      size %= sizeof (word_t);
+    }
+
   while (size-- > 0)
     *dst++ = value;
 
@@ -296,7 +400,15 @@ strlen (const char *string)
 
   ASSERT (string != NULL);
 
-  for (p = string; *p != '\0'; p++)
+  /* Check bytes up to a word boundary, then whole words. */
+  for (p = string; !is_aligned (p); p++)
+    if (*p == '\0')
+      return p - string;
+  while (!has_zero_byte (*(const word_t *) p))
+    p += sizeof (word_t);
+
+  /* Find the null byte within the word. */
+  for (; *p != '\0'; p++)
     continue;
   return p - string;
 }
@@ -28,7 +28,13 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Buffer cache extension. */
+    SYS_FSYNC,                  /* Write a file's data to disk. */
+
+    /* Process cloning. */
+    SYS_FORK                    /* Clone the current process. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -45,4 +45,10 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Buffer cache extension. */
+bool fsync (int fd);
+
+/* Process cloning. */
+pid_t fork (void);
+
 #endif /* lib/user/syscall.h */
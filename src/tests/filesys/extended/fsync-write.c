@@ -0,0 +1,34 @@
+/* Writes a file one byte at a time, as a program with unbuffered
+   output would, then forces it to disk with fsync and verifies
+   its contents.  Also checks that fsync rejects a closed file
+   descriptor. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[1234];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  size_t i;
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  msg ("write \"%s\" byte by byte", file_name);
+  for (i = 0; i < sizeof buf; i++)
+    if (write (fd, buf + i, 1) != 1)
+      fail ("write at offset %zu failed", i);
+  CHECK (fsync (fd), "fsync \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  CHECK (!fsync (fd), "fsync closed fd must fail");
+  check_file (file_name, buf, sizeof buf);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fsync-write) begin
+(fsync-write) create "testfile"
+(fsync-write) open "testfile"
+(fsync-write) write "testfile" byte by byte
+(fsync-write) fsync "testfile"
+(fsync-write) close "testfile"
+(fsync-write) fsync closed fd must fail
+(fsync-write) open "testfile" for verification
+(fsync-write) verified contents of "testfile"
+(fsync-write) close "testfile"
+(fsync-write) end
+pass;
@@ -0,0 +1,7 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($data) = join ("\0" x 512, map (chr (ord ('a') + $_ % 26) x 512, 0 .. 249));
+check_archive ({"testfile" => [$data]});
+pass;
@@ -0,0 +1,37 @@
+/* Writes one sector out of every two in a file, so that the
+   file ends up with more separate runs of data than fit in the
+   inode and its first few overflow blocks, and checks that the
+   data and the holes between them read back correctly. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define RUN_CNT 250
+
+static char buf[(RUN_CNT * 2 - 1) * 512];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  size_t i;
+  int fd;
+
+  for (i = 0; i < RUN_CNT; i++)
+    memset (buf + i * 1024, 'a' + i % 26, 512);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  msg ("write %d runs to \"%s\"", RUN_CNT, file_name);
+  for (i = 0; i < RUN_CNT; i++)
+    {
+      seek (fd, i * 1024);
+      if (write (fd, buf + i * 1024, 512) != 512)
+        fail ("write run %zu failed", i);
+    }
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
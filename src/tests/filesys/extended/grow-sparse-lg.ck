@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-sparse-lg) begin
+(grow-sparse-lg) create "testfile"
+(grow-sparse-lg) open "testfile"
+(grow-sparse-lg) write 250 runs to "testfile"
+(grow-sparse-lg) close "testfile"
+(grow-sparse-lg) open "testfile" for verification
+(grow-sparse-lg) verified contents of "testfile"
+(grow-sparse-lg) close "testfile"
+(grow-sparse-lg) end
+EOF
+pass;
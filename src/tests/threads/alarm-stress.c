@@ -0,0 +1,124 @@
+/* Creates thousands of threads, each of which sleeps until a
+   random deadline, and reports how late each one woke up.
+
+   No thread may wake before its deadline.  Lateness is reported
+   as a histogram in ticks, along with its mean and maximum, so
+   that timer implementations can be compared.  Lateness of a
+   tick or two is expected because woken threads still have to
+   wait their turn to run. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <random.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define THREAD_CNT 2000         /* Number of sleeping threads. */
+#define MAX_DELAY 500           /* Longest sleep, in ticks. */
+#define HISTOGRAM_CNT 8         /* Lateness histogram buckets. */
+
+/* Information about the test. */
+struct stress_test
+  {
+    struct semaphore done;      /* Upped by each thread on exit. */
+    struct lock stats_lock;     /* Protects the fields below. */
+    int early;                  /* Threads that woke too soon. */
+    int64_t total_lateness;     /* Sum of lateness, in ticks. */
+    int64_t max_lateness;       /* Largest lateness, in ticks. */
+    int histogram[HISTOGRAM_CNT]; /* Lateness counts; last is "or more". */
+  };
+
+/* Information about an individual sleeper. */
+struct stress_thread
+  {
+    struct stress_test *test;   /* Info shared between all threads. */
+    int64_t deadline;           /* Absolute tick to wake up at. */
+  };
+
+static void sleeper (void *);
+
+void
+test_alarm_stress (void)
+{
+  struct stress_test test;
+  struct stress_thread *threads;
+  int64_t start;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  threads = malloc (sizeof *threads * THREAD_CNT);
+  if (threads == NULL)
+    PANIC ("couldn't allocate memory for test");
+
+  sema_init (&test.done, 0);
+  lock_init (&test.stats_lock);
+  test.early = 0;
+  test.total_lateness = 0;
+  test.max_lateness = 0;
+  for (i = 0; i < HISTOGRAM_CNT; i++)
+    test.histogram[i] = 0;
+
+  msg ("Creating %d threads to sleep up to %d ticks each.",
+       THREAD_CNT, MAX_DELAY);
+
+  random_init (0);
+  start = timer_ticks () + 5 * TIMER_FREQ;
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      struct stress_thread *t = &threads[i];
+      char name[16];
+
+      t->test = &test;
+      t->deadline = start + random_ulong () % MAX_DELAY + 1;
+      snprintf (name, sizeof name, "sleeper %d", i);
+      if (thread_create (name, PRI_DEFAULT, sleeper, t) == TID_ERROR)
+        fail ("couldn't create thread %d", i);
+    }
+
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&test.done);
+
+  msg ("%d threads woke before their deadline.", test.early);
+  for (i = 0; i < HISTOGRAM_CNT; i++)
+    msg ("Lateness %d%s ticks: %d threads.",
+         i, i == HISTOGRAM_CNT - 1 ? " or more" : "", test.histogram[i]);
+  msg ("Mean lateness %"PRId64"/100 ticks, max lateness %"PRId64" ticks.",
+       test.total_lateness * 100 / THREAD_CNT, test.max_lateness);
+
+  free (threads);
+  if (test.early != 0)
+    fail ("some threads woke up early");
+  pass ();
+}
+
+/* Sleeper thread. */
+static void
+sleeper (void *t_)
+{
+  struct stress_thread *t = t_;
+  struct stress_test *test = t->test;
+  int64_t lateness;
+
+  timer_sleep (t->deadline - timer_ticks ());
+  lateness = timer_ticks () - t->deadline;
+
+  lock_acquire (&test->stats_lock);
+  if (lateness < 0)
+    test->early++;
+  else
+    {
+      test->total_lateness += lateness;
+      if (lateness > test->max_lateness)
+        test->max_lateness = lateness;
+      test->histogram[lateness < HISTOGRAM_CNT ? lateness : HISTOGRAM_CNT - 1]++;
+    }
+  lock_release (&test->stats_lock);
+
+  sema_up (&test->done);
+}
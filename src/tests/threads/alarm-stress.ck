@@ -0,0 +1,44 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::threads::bench;
+my (@values) = check_bench (<<'EOF');
+(alarm-stress) begin
+(alarm-stress) Creating 2000 threads to sleep up to 500 ticks each.
+(alarm-stress) 0 threads woke before their deadline.
+(alarm-stress) Lateness 0 ticks: # threads.
+(alarm-stress) Lateness 1 ticks: # threads.
+(alarm-stress) Lateness 2 ticks: # threads.
+(alarm-stress) Lateness 3 ticks: # threads.
+(alarm-stress) Lateness 4 ticks: # threads.
+(alarm-stress) Lateness 5 ticks: # threads.
+(alarm-stress) Lateness 6 ticks: # threads.
+(alarm-stress) Lateness 7 or more ticks: # threads.
+(alarm-stress) Mean lateness #/100 ticks, max lateness # ticks.
+(alarm-stress) PASS
+(alarm-stress) end
+EOF
+my (@histogram) = splice (@values, 0, 8);
+my ($mean, $max) = @values;
+
+# Every thread falls in exactly one bucket, and the highest
+# nonempty bucket is the one for the max lateness.
+my ($total, $min_lateness) = (0, 0);
+for my $i (0...$#histogram) {
+    fail "Negative thread count for lateness $i.\n" if $histogram[$i] < 0;
+    $total += $histogram[$i];
+    $min_lateness += $i * $histogram[$i];
+}
+fail "Lateness histogram adds up to $total threads, not 2000.\n"
+  if $total != 2000;
+my ($top) = $max < $#histogram ? $max : $#histogram;
+fail "Max lateness of $max ticks doesn't match the histogram.\n"
+  if ($max < 0 || $histogram[$top] == 0
+      || grep ($_ != 0, @histogram[$top + 1...$#histogram]));
+
+# The mean can't be below what the histogram accounts for, nor
+# above the max.
+fail "Mean lateness of $mean/100 ticks doesn't match the histogram.\n"
+  if $mean < int ($min_lateness * 100 / 2000) || $mean > $max * 100;
+pass;
@@ -0,0 +1,94 @@
+# -*- perl -*-
+use strict;
+use warnings;
+
+# Compares the output of a benchmark against EXPECTED, which
+# lists the lines it must print, in order, with "#" standing for
+# each integer that may vary from run to run, and returns those
+# integers in order.  The caller checks that they are sane.
+sub check_bench {
+    my ($expected) = @_;
+    our ($test);
+    my (@output) = read_text_file ("$test.output");
+    common_checks ("run", @output);
+    @output = get_core_output ("run", @output);
+
+    my (@expected) = split ("\n", $expected);
+    my (@values);
+    for my $i (0...$#expected) {
+	fail "Output ended before expected line:\n  $expected[$i]\n"
+	  if $i > $#output;
+
+	my ($pattern) = quotemeta ($expected[$i]);
+	$pattern =~ s/\\#/(-?\\d+)/g;
+	my (@line) = $output[$i] =~ /^$pattern$/
+	  or fail "Output line:\n  $output[$i]\ndoesn't match expected:\n"
+		  . "  $expected[$i]\n";
+
+	my ($value_cnt) = $expected[$i] =~ tr/#//;
+	push (@values, @line[0...$value_cnt - 1]);
+    }
+    fail "Unexpected output after the end of the benchmark:\n"
+      . "  $output[$#expected + 1]\n"
+      if @output > @expected;
+    return @values;
+}
+
+# Checks the output of sched-bench, run as test NAME.
+sub check_sched_bench {
+    my ($name) = @_;
+    my (@values) = check_bench (<<EOF);
+($name) begin
+($name) Idle baseline: # loops per tick.
+($name) Starting 4 CPU-bound and 4 I/O-bound threads...
+($name) Sleeping 25 seconds to let threads run, please wait...
+($name) CPU thread 0 received # ticks.
+($name) CPU thread 1 received # ticks.
+($name) CPU thread 2 received # ticks.
+($name) CPU thread 3 received # ticks.
+($name) CPU tick spread: # (min #, max #).
+($name) I/O thread 0 woke # times, mean lateness #/100 ticks, max lateness # ticks.
+($name) I/O thread 1 woke # times, mean lateness #/100 ticks, max lateness # ticks.
+($name) I/O thread 2 woke # times, mean lateness #/100 ticks, max lateness # ticks.
+($name) I/O thread 3 woke # times, mean lateness #/100 ticks, max lateness # ticks.
+($name) Loaded: # loops per tick, overhead #/1000.
+($name) PASS
+($name) end
+EOF
+    my ($baseline) = shift (@values);
+    my (@cpu) = splice (@values, 0, 4);
+    my ($spread, $min, $max) = splice (@values, 0, 3);
+    my (@io) = splice (@values, 0, 12);
+    my ($loops, $overhead) = @values;
+
+    fail "Idle baseline should be positive.\n" if $baseline <= 0;
+
+    # The CPU threads spin for 20 seconds, at 100 ticks per second,
+    # and should share that time about equally.
+    my ($total, $real_min, $real_max) = (0, $cpu[0], $cpu[0]);
+    foreach my $ticks (@cpu) {
+	$total += $ticks;
+	$real_min = $ticks if $ticks < $real_min;
+	$real_max = $ticks if $ticks > $real_max;
+    }
+    fail "CPU threads received $total ticks in 2000.\n"
+      if $total <= 0 || $total > 2000 + @cpu;
+    fail "CPU tick spread doesn't match the tick counts.\n"
+      if $min != $real_min || $max != $real_max || $spread != $max - $min;
+    fail "A CPU thread received less than half as many ticks as another.\n"
+      if $min * 2 < $max;
+
+    for my $i (0...3) {
+	my ($wakeups, $mean, $worst) = @io[$i * 3...$i * 3 + 2];
+	fail "I/O thread $i never woke up.\n" if $wakeups <= 0;
+	fail "I/O thread $i has mean lateness over its max lateness.\n"
+	  if $mean < 0 || $mean > $worst * 100;
+    }
+
+    fail "Loaded loops per tick should be positive.\n" if $loops <= 0;
+    fail "Overhead of $overhead/1000 is out of range.\n"
+      if $overhead >= 1000;
+    pass;
+}
+
+1;
@@ -0,0 +1,150 @@
+/* Times bitmap_scan() and bitmap_count() on a large, fragmented
+   bitmap, like a long-lived free map, against straightforward
+   bit-at-a-time versions of the same operations, and checks that
+   both give the same answers.
+
+   The bitmap alternates random-length runs of set bits (up to
+   64 long) with random-length runs of clear bits (up to 16
+   long).  Each scan benchmark finds every run of CNT clear bits
+   from the start of the bitmap to the end, the way an allocator
+   walks a free map. */
+
+#include <bitmap.h>
+#include <inttypes.h>
+#include <random.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "devices/timer.h"
+
+#define BIT_CNT (256 * 1024)    /* Bits in the bitmap. */
+#define MAX_SET_RUN 64          /* Longest run of set bits. */
+#define MAX_CLEAR_RUN 16        /* Longest run of clear bits. */
+#define COUNT_ITERATIONS 16     /* Times to count the whole bitmap. */
+
+static size_t slow_scan (const struct bitmap *, size_t start, size_t cnt,
+                         bool value);
+static size_t slow_count (const struct bitmap *, size_t start, size_t cnt,
+                          bool value);
+static void report (const char *what, uint64_t slow_nsec, uint64_t fast_nsec);
+
+void
+test_bitmap_bench (void) 
+{
+  static const size_t scan_cnts[] = {1, 4, 8, 16};
+  struct bitmap *b;
+  size_t i;
+
+  b = bitmap_create (BIT_CNT);
+  if (b == NULL)
+    fail ("couldn't allocate bitmap");
+
+  /* Fragment the bitmap. */
+  random_init (0);
+  for (i = 0; i < BIT_CNT; )
+    {
+      size_t set_run = random_ulong () % MAX_SET_RUN + 1;
+      size_t clear_run = random_ulong () % MAX_CLEAR_RUN + 1;
+      if (set_run > BIT_CNT - i)
+        set_run = BIT_CNT - i;
+      bitmap_set_multiple (b, i, set_run, true);
+      i += set_run + clear_run;
+    }
+  msg ("%zu of %d bits set.", bitmap_count (b, 0, BIT_CNT, true), BIT_CNT);
+
+  for (i = 0; i < sizeof scan_cnts / sizeof *scan_cnts; i++) 
+    {
+      size_t cnt = scan_cnts[i];
+      size_t slow_found = 0, fast_found = 0;
+      size_t idx;
+      uint64_t start, slow_nsec, fast_nsec;
+      char what[32];
+
+      start = timer_nsec ();
+      for (idx = 0; (idx = slow_scan (b, idx, cnt, false)) != BITMAP_ERROR;
+           idx++)
+        slow_found++;
+      slow_nsec = timer_nsec () - start;
+
+      start = timer_nsec ();
+      for (idx = 0; (idx = bitmap_scan (b, idx, cnt, false)) != BITMAP_ERROR;
+           idx++)
+        fast_found++;
+      fast_nsec = timer_nsec () - start;
+
+      if (slow_found != fast_found)
+        fail ("scan for %zu clear bits found %zu runs, expected %zu",
+              cnt, fast_found, slow_found);
+      snprintf (what, sizeof what, "scan for %zu clear bits", cnt);
+      report (what, slow_nsec, fast_nsec);
+    }
+
+  {
+    size_t slow_total = 0, fast_total = 0;
+    uint64_t start, slow_nsec, fast_nsec;
+
+    start = timer_nsec ();
+    for (i = 0; i < COUNT_ITERATIONS; i++)
+      slow_total += slow_count (b, 1, BIT_CNT - 2, false);
+    slow_nsec = timer_nsec () - start;
+
+    start = timer_nsec ();
+    for (i = 0; i < COUNT_ITERATIONS; i++)
+      fast_total += bitmap_count (b, 1, BIT_CNT - 2, false);
+    fast_nsec = timer_nsec () - start;
+
+    if (slow_total != fast_total)
+      fail ("count found %zu clear bits, expected %zu",
+            fast_total, slow_total);
+    report ("count", slow_nsec, fast_nsec);
+  }
+
+  bitmap_destroy (b);
+  pass ();
+}
+
+/* Prints the times for one operation. */
+static void
+report (const char *what, uint64_t slow_nsec, uint64_t fast_nsec) 
+{
+  if (fast_nsec == 0)
+    fast_nsec = 1;
+  msg ("%s: bit-at-a-time %"PRIu64" us, word-at-a-time %"PRIu64" us "
+       "(%"PRIu64".%"PRIu64"x).",
+       what, slow_nsec / 1000, fast_nsec / 1000,
+       slow_nsec / fast_nsec, slow_nsec * 10 / fast_nsec % 10);
+}
+
+/* bitmap_scan(), testing one bit at a time. */
+static size_t
+slow_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  size_t size = bitmap_size (b);
+
+  if (cnt <= size) 
+    {
+      size_t last = size - cnt;
+      size_t i, j;
+      for (i = start; i <= last; i++)
+        {
+          for (j = 0; j < cnt; j++)
+            if (bitmap_test (b, i + j) != value)
+              break;
+          if (j == cnt)
+            return i;
+        }
+    }
+  return BITMAP_ERROR;
+}
+
+/* bitmap_count(), testing one bit at a time. */
+static size_t
+slow_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  size_t i, value_cnt = 0;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      value_cnt++;
+  return value_cnt;
+}
@@ -0,0 +1,33 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::threads::bench;
+my (@values) = check_bench (<<'EOF');
+(bitmap-bench) begin
+(bitmap-bench) # of 262144 bits set.
+(bitmap-bench) scan for 1 clear bits: bit-at-a-time # us, word-at-a-time # us (#.#x).
+(bitmap-bench) scan for 4 clear bits: bit-at-a-time # us, word-at-a-time # us (#.#x).
+(bitmap-bench) scan for 8 clear bits: bit-at-a-time # us, word-at-a-time # us (#.#x).
+(bitmap-bench) scan for 16 clear bits: bit-at-a-time # us, word-at-a-time # us (#.#x).
+(bitmap-bench) count: bit-at-a-time # us, word-at-a-time # us (#.#x).
+(bitmap-bench) PASS
+(bitmap-bench) end
+EOF
+my ($set) = shift (@values);
+fail "$set of 262144 bits set, but the bitmap should be fragmented.\n"
+  if $set <= 0 || $set >= 262144;
+
+for my $i (0...4) {
+    my ($slow, $fast, $ratio, $tenths) = @values[$i * 4...$i * 4 + 3];
+    fail "Negative time or speedup in line " . ($i + 3) . " of output.\n"
+      if $slow < 0 || $fast < 0 || $ratio < 0 || $tenths < 0 || $tenths > 9;
+}
+
+# Counting the whole bitmap 16 times takes long enough to time
+# reliably, and a word at a time must win.
+my ($slow, $fast) = @values[16, 17];
+fail "Counting a word at a time took $fast us, "
+  . "but a bit at a time only $slow us.\n"
+  if $fast >= $slow;
+pass;
@@ -0,0 +1,193 @@
+/* Compares the round-robin and MLFQS schedulers on a mix of
+   CPU-bound and I/O-bound threads.
+
+   Each CPU-bound thread spins, counting the timer ticks during
+   which it ran and the loop iterations it completed.  Each
+   I/O-bound thread repeatedly sleeps for one tick and records
+   how late it was rescheduled.  A fair scheduler gives the
+   CPU-bound threads nearly equal tick counts while keeping the
+   I/O-bound threads' lateness low.
+
+   Scheduler overhead is estimated by first measuring how many
+   loop iterations the main thread completes per tick with
+   nothing else runnable, then comparing that against the
+   iterations per tick the CPU-bound threads achieve under
+   load.  The difference is time spent in the timer interrupt,
+   the scheduler, and context switches.
+
+   sched-bench-rr runs under the default scheduler and
+   sched-bench-mlfqs under "-mlfqs", so the two outputs can be
+   compared directly. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define CPU_THREAD_CNT 4
+#define IO_THREAD_CNT 4
+#define BENCH_SECONDS 20
+
+struct cpu_info
+  {
+    int64_t start_time;
+    int tick_count;
+    int64_t loops;
+  };
+
+struct io_info
+  {
+    int64_t start_time;
+    int wakeups;
+    int64_t total_lateness;
+    int64_t max_lateness;
+  };
+
+static void test_sched_bench (void);
+static int64_t spin_one_second (void);
+static void cpu_thread (void *);
+static void io_thread (void *);
+
+void
+test_sched_bench_rr (void)
+{
+  ASSERT (!thread_mlfqs);
+  test_sched_bench ();
+}
+
+void
+test_sched_bench_mlfqs (void)
+{
+  ASSERT (thread_mlfqs);
+  thread_set_nice (-20);
+  test_sched_bench ();
+}
+
+static void
+test_sched_bench (void)
+{
+  struct cpu_info cpu[CPU_THREAD_CNT];
+  struct io_info io[IO_THREAD_CNT];
+  int64_t baseline, start_time, loops, ticks;
+  int min_ticks, max_ticks;
+  int i;
+
+  baseline = spin_one_second ();
+  msg ("Idle baseline: %"PRId64" loops per tick.", baseline);
+
+  start_time = timer_ticks ();
+  msg ("Starting %d CPU-bound and %d I/O-bound threads...",
+       CPU_THREAD_CNT, IO_THREAD_CNT);
+  for (i = 0; i < CPU_THREAD_CNT; i++)
+    {
+      char name[16];
+
+      cpu[i].start_time = start_time;
+      cpu[i].tick_count = 0;
+      cpu[i].loops = 0;
+      snprintf (name, sizeof name, "cpu %d", i);
+      thread_create (name, PRI_DEFAULT, cpu_thread, &cpu[i]);
+    }
+  for (i = 0; i < IO_THREAD_CNT; i++)
+    {
+      char name[16];
+
+      io[i].start_time = start_time;
+      io[i].wakeups = 0;
+      io[i].total_lateness = 0;
+      io[i].max_lateness = 0;
+      snprintf (name, sizeof name, "io %d", i);
+      thread_create (name, PRI_DEFAULT, io_thread, &io[i]);
+    }
+
+  msg ("Sleeping %d seconds to let threads run, please wait...",
+       BENCH_SECONDS + 5);
+  timer_sleep ((BENCH_SECONDS + 5) * TIMER_FREQ);
+
+  loops = ticks = 0;
+  min_ticks = max_ticks = cpu[0].tick_count;
+  for (i = 0; i < CPU_THREAD_CNT; i++)
+    {
+      msg ("CPU thread %d received %d ticks.", i, cpu[i].tick_count);
+      loops += cpu[i].loops;
+      ticks += cpu[i].tick_count;
+      if (cpu[i].tick_count < min_ticks)
+        min_ticks = cpu[i].tick_count;
+      if (cpu[i].tick_count > max_ticks)
+        max_ticks = cpu[i].tick_count;
+    }
+  msg ("CPU tick spread: %d (min %d, max %d).",
+       max_ticks - min_ticks, min_ticks, max_ticks);
+
+  for (i = 0; i < IO_THREAD_CNT; i++)
+    msg ("I/O thread %d woke %d times, mean lateness %"PRId64
+         "/100 ticks, max lateness %"PRId64" ticks.",
+         i, io[i].wakeups,
+         io[i].wakeups > 0 ? io[i].total_lateness * 100 / io[i].wakeups : 0,
+         io[i].max_lateness);
+
+  if (ticks > 0 && baseline > 0)
+    msg ("Loaded: %"PRId64" loops per tick, overhead %"PRId64"/1000.",
+         loops / ticks, 1000 - loops / ticks * 1000 / baseline);
+  pass ();
+}
+
+/* Spins for one second in the current thread and returns the
+   average number of loop iterations completed per tick. */
+static int64_t
+spin_one_second (void)
+{
+  int64_t start = timer_ticks ();
+  int64_t loops = 0;
+
+  while (timer_ticks () == start)
+    continue;
+  start = timer_ticks ();
+  while (timer_elapsed (start) < TIMER_FREQ)
+    loops++;
+  return loops / TIMER_FREQ;
+}
+
+static void
+cpu_thread (void *info_)
+{
+  struct cpu_info *info = info_;
+  int64_t sleep_time = 5 * TIMER_FREQ;
+  int64_t spin_time = sleep_time + BENCH_SECONDS * TIMER_FREQ;
+  int64_t last_time = 0;
+
+  timer_sleep (sleep_time - timer_elapsed (info->start_time));
+  while (timer_elapsed (info->start_time) < spin_time)
+    {
+      int64_t cur_time = timer_ticks ();
+      if (cur_time != last_time)
+        info->tick_count++;
+      last_time = cur_time;
+      info->loops++;
+    }
+}
+
+static void
+io_thread (void *info_)
+{
+  struct io_info *info = info_;
+  int64_t sleep_time = 5 * TIMER_FREQ;
+  int64_t spin_time = sleep_time + BENCH_SECONDS * TIMER_FREQ;
+
+  timer_sleep (sleep_time - timer_elapsed (info->start_time));
+  while (timer_elapsed (info->start_time) < spin_time)
+    {
+      int64_t wake_time = timer_ticks () + 1;
+      int64_t lateness;
+
+      timer_sleep (1);
+      lateness = timer_ticks () - wake_time;
+      info->wakeups++;
+      info->total_lateness += lateness;
+      if (lateness > info->max_lateness)
+        info->max_lateness = lateness;
+    }
+}
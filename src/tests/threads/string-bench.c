@@ -0,0 +1,224 @@
+/* Times memcpy(), memset(), memcmp(), memchr(), and strlen()
+   against straightforward byte-at-a-time versions of the same
+   functions, across block sizes from a few words to a page and
+   with both word-aligned and misaligned pointers, and checks
+   that the library functions give the right results.
+
+   Each measurement processes about the same total number of
+   bytes, so times for different sizes are comparable. */
+
+#include <inttypes.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
+
+#define TOTAL_BYTES (1024 * 1024)  /* Bytes processed per timing. */
+
+static void *slow_memcpy (void *, const void *, size_t);
+static void *slow_memset (void *, int, size_t);
+static int slow_memcmp (const void *, const void *, size_t);
+static void *slow_memchr (const void *, int, size_t);
+static size_t slow_strlen (const char *);
+static void report (const char *what, size_t size, size_t ofs,
+                    uint64_t slow_nsec, uint64_t fast_nsec);
+
+/* Buffers, each a page plus room for misalignment. */
+static uint8_t *src, *dst;
+
+/* Keeps the compiler from merging, moving, or dropping memory
+   accesses and calls across it. */
+#define BARRIER() asm volatile ("" : : : "memory")
+
+/* Receives each result, so that calls are not optimized away. */
+static volatile uintptr_t sink;
+
+/* Evaluates the byte-at-a-time expression SLOW and the library
+   expression FAST, ITERS times each, and leaves the elapsed
+   nanoseconds in SLOW_NSEC and FAST_NSEC. */
+#define TIME(SLOW_NSEC, FAST_NSEC, ITERS, SLOW, FAST)           \
+        do {                                                    \
+          uint64_t start_;                                      \
+          size_t i_;                                            \
+                                                                \
+          start_ = timer_nsec ();                               \
+          for (i_ = 0; i_ < (ITERS); i_++)                      \
+            {                                                   \
+              sink = (uintptr_t) (SLOW);                        \
+              BARRIER ();                                       \
+            }                                                   \
+          SLOW_NSEC = timer_nsec () - start_;                   \
+                                                                \
+          start_ = timer_nsec ();                               \
+          for (i_ = 0; i_ < (ITERS); i_++)                      \
+            {                                                   \
+              sink = (uintptr_t) (FAST);                        \
+              BARRIER ();                                       \
+            }                                                   \
+          FAST_NSEC = timer_nsec () - start_;                   \
+        } while (0)
+
+void
+test_string_bench (void)
+{
+  static const size_t sizes[] = {16, 64, 256, 1024, 4096};
+  static const size_t ofss[] = {0, 1};
+  size_t i, j, k;
+
+  src = palloc_get_multiple (PAL_ASSERT, 2);
+  dst = palloc_get_multiple (PAL_ASSERT, 2);
+  random_init (0);
+  for (i = 0; i < 2 * PGSIZE; i++)
+    src[i] = random_ulong () % 254 + 1;
+
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    for (j = 0; j < sizeof ofss / sizeof *ofss; j++)
+      {
+        size_t size = sizes[i];
+        size_t ofs = ofss[j];
+        size_t iters = TOTAL_BYTES / size;
+        uint8_t *s = src + ofs;
+        uint8_t *d = dst + ofs * 3;
+        uint64_t slow_nsec, fast_nsec;
+
+        /* memcpy(), with SRC and DST misaligned differently. */
+        TIME (slow_nsec, fast_nsec, iters,
+              slow_memcpy (d, s, size), memcpy (d, s, size));
+        for (k = 0; k < size; k++)
+          if (d[k] != s[k])
+            fail ("memcpy of %zu bytes at offset %zu: byte %zu wrong",
+                  size, ofs, k);
+        report ("memcpy", size, ofs, slow_nsec, fast_nsec);
+
+        /* memset(). */
+        TIME (slow_nsec, fast_nsec, iters,
+              slow_memset (d, 0xa5, size), memset (d, 0x5a, size));
+        for (k = 0; k < size; k++)
+          if (d[k] != 0x5a)
+            fail ("memset of %zu bytes at offset %zu: byte %zu wrong",
+                  size, ofs, k);
+        report ("memset", size, ofs, slow_nsec, fast_nsec);
+
+        /* memcmp() of blocks that differ only in the last byte. */
+        memcpy (d, s, size);
+        d[size - 1] = s[size - 1] + 1;
+        TIME (slow_nsec, fast_nsec, iters,
+              slow_memcmp (s, d, size), memcmp (s, d, size));
+        if (memcmp (s, d, size) >= 0 || memcmp (d, s, size) <= 0
+            || memcmp (s, d, size - 1) != 0)
+          fail ("memcmp of %zu bytes at offset %zu: wrong result",
+                size, ofs);
+        report ("memcmp", size, ofs, slow_nsec, fast_nsec);
+
+        /* memchr() for a byte that is only at the end. */
+        memcpy (d, s, size);
+        d[size - 1] = 0;
+        TIME (slow_nsec, fast_nsec, iters,
+              slow_memchr (d, 0, size), memchr (d, 0, size));
+        if (memchr (d, 0, size) != slow_memchr (d, 0, size)
+            || memchr (d, 0, size - 1) != NULL)
+          fail ("memchr in %zu bytes at offset %zu: wrong result",
+                size, ofs);
+        report ("memchr", size, ofs, slow_nsec, fast_nsec);
+
+        /* strlen() of a string of SIZE - 1 characters. */
+        TIME (slow_nsec, fast_nsec, iters,
+              slow_strlen ((char *) d), strlen ((char *) d));
+        if (strlen ((char *) d) != size - 1)
+          fail ("strlen of %zu characters at offset %zu: got %zu",
+                size - 1, ofs, strlen ((char *) d));
+        report ("strlen", size, ofs, slow_nsec, fast_nsec);
+      }
+
+  palloc_free_multiple (src, 2);
+  palloc_free_multiple (dst, 2);
+  pass ();
+}
+
+/* Prints the times for one operation. */
+static void
+report (const char *what, size_t size, size_t ofs,
+        uint64_t slow_nsec, uint64_t fast_nsec)
+{
+  if (fast_nsec == 0)
+    fast_nsec = 1;
+  msg ("%s %zu bytes, %s: byte-at-a-time %"PRIu64" us, "
+       "library %"PRIu64" us (%"PRIu64".%"PRIu64"x).",
+       what, size, ofs == 0 ? "aligned" : "misaligned",
+       slow_nsec / 1000, fast_nsec / 1000,
+       slow_nsec / fast_nsec, slow_nsec * 10 / fast_nsec % 10);
+}
+
+/* The byte-at-a-time versions.  The barriers keep the compiler
+   from turning their loops into calls to the library
+   functions. */
+
+static void *
+slow_memcpy (void *dst_, const void *src_, size_t size)
+{
+  uint8_t *d = dst_;
+  const uint8_t *s = src_;
+
+  while (size-- > 0)
+    {
+      *d++ = *s++;
+      BARRIER ();
+    }
+  return dst_;
+}
+
+static void *
+slow_memset (void *dst_, int value, size_t size)
+{
+  uint8_t *d = dst_;
+
+  while (size-- > 0)
+    {
+      *d++ = value;
+      BARRIER ();
+    }
+  return dst_;
+}
+
+static int
+slow_memcmp (const void *a_, const void *b_, size_t size)
+{
+  const uint8_t *a = a_;
+  const uint8_t *b = b_;
+
+  for (; size-- > 0; a++, b++)
+    {
+      BARRIER ();
+      if (*a != *b)
+        return *a > *b ? +1 : -1;
+    }
+  return 0;
+}
+
+static void *
+slow_memchr (const void *block_, int ch_, size_t size)
+{
+  const uint8_t *block = block_;
+  uint8_t ch = ch_;
+
+  for (; size-- > 0; block++)
+    {
+      BARRIER ();
+      if (*block == ch)
+        return (void *) block;
+    }
+  return NULL;
+}
+
+static size_t
+slow_strlen (const char *string)
+{
+  const char *p;
+
+  for (p = string; *p != '\0'; p++)
+    BARRIER ();
+  return p - string;
+}
@@ -0,0 +1,40 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::threads::bench;
+
+my (@ops) = ('memcpy', 'memset', 'memcmp', 'memchr', 'strlen');
+my (@sizes) = (16, 64, 256, 1024, 4096);
+my (@alignments) = ('aligned', 'misaligned');
+
+my ($expected) = "(string-bench) begin\n";
+foreach my $size (@sizes) {
+    foreach my $alignment (@alignments) {
+	foreach my $op (@ops) {
+	    $expected .= "(string-bench) $op $size bytes, $alignment: "
+	      . "byte-at-a-time # us, library # us (#.#x).\n";
+	}
+    }
+}
+$expected .= "(string-bench) PASS\n(string-bench) end\n";
+my (@values) = check_bench ($expected);
+
+foreach my $size (@sizes) {
+    foreach my $alignment (@alignments) {
+	foreach my $op (@ops) {
+	    my ($slow, $fast, $ratio, $tenths) = splice (@values, 0, 4);
+	    fail "Negative time or speedup for $op $size bytes, $alignment.\n"
+	      if ($slow < 0 || $fast < 0 || $ratio < 0
+		  || $tenths < 0 || $tenths > 9);
+
+	    # Each timing covers 1 MB, so at 4096 bytes per call the
+	    # per-call overhead is negligible and a word at a time
+	    # must win.
+	    fail "Library $op of $size $alignment bytes took $fast us, "
+	      . "but byte-at-a-time only $slow us.\n"
+	      if $size == 4096 && $alignment eq 'aligned' && $fast >= $slow;
+	}
+    }
+}
+pass;
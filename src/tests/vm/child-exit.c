@@ -0,0 +1,9 @@
+/* Child process run by fork-bench.
+   Exits at once, so that only the cost of creating and
+   destroying a process is measured. */
+
+int
+main (void)
+{
+  return 0;
+}
@@ -0,0 +1,35 @@
+/* Times process creation by fork() against exec().  Runs
+   ITERATIONS cycles in which a child is created, exits at once,
+   and is waited for, first with fork() and then with exec() of a
+   program that does nothing.  The kernel reports the average
+   length of each kind of cycle at shutdown. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ITERATIONS 20
+
+void
+test_main (void)
+{
+  int i;
+
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      pid_t pid = fork ();
+      if (pid == 0)
+        exit (0);
+      if (pid < 0 || wait (pid) != 0)
+        fail ("fork cycle %d failed", i);
+    }
+  msg ("%d fork-exit-wait cycles", ITERATIONS);
+
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      pid_t pid = exec ("child-exit");
+      if (pid < 0 || wait (pid) != 0)
+        fail ("exec cycle %d failed", i);
+    }
+  msg ("%d exec-exit-wait cycles", ITERATIONS);
+}
@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-bench) begin
+(fork-bench) 20 fork-exit-wait cycles
+(fork-bench) 20 exec-exit-wait cycles
+(fork-bench) end
+EOF
+
+# The kernel's shutdown statistics must have timed every cycle.
+# The test itself is one more exec-exit-wait cycle.
+our ($test);
+my (@output) = read_text_file ("$test.output");
+foreach my $kind ('fork', 'exec') {
+    my ($cnt, $us)
+      = map (/^Process: (\d+) $kind-exit-wait cycles, (\d+) us average$/,
+	     @output);
+    fail "missing $kind-exit-wait timing in output\n" if !defined $cnt;
+    fail "only $cnt $kind-exit-wait cycles timed\n" if $cnt < 20;
+    fail "$kind-exit-wait cycles took no time\n" if $us == 0;
+}
+pass;
@@ -0,0 +1,90 @@
+/* Forks a child, then writes to the parent's data, BSS, and
+   stack while the child is still running.  The child checks
+   that it sees the values from before the fork, not the
+   parent's new ones, then modifies its own copies, partly by
+   storing to them and partly by read() into pages that it still
+   shares copy-on-write with the parent.  The parent then checks
+   that none of the child's changes reached its own memory. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static int data_var = 123;
+static char bss_buf[4096 * 4];
+static char file_buf[4096 * 2];
+
+/* Runs in the child.  Returns 42 only if everything was as
+   expected. */
+static int
+child (volatile int *stack_var)
+{
+  size_t i;
+  int fd;
+
+  /* Wait until the parent has written to its memory. */
+  while ((fd = open ("go")) < 0)
+    continue;
+  close (fd);
+
+  if (data_var != 123 || *stack_var != 456)
+    return 1;
+  for (i = 0; i < sizeof bss_buf; i++)
+    if (bss_buf[i] != 'p')
+      return 2;
+
+  data_var = 789;
+  *stack_var = 789;
+  memset (bss_buf, 'c', 4096);
+
+  /* BSS_BUF's later pages are still shared with the parent. */
+  fd = open ("cow-data");
+  if (fd < 0 || read (fd, bss_buf + 4096, sizeof file_buf)
+                != (int) sizeof file_buf)
+    return 3;
+  close (fd);
+
+  if (data_var != 789 || *stack_var != 789)
+    return 4;
+  for (i = 0; i < sizeof bss_buf; i++)
+    if (bss_buf[i] != (i < 4096 ? 'c'
+                       : i < 4096 + sizeof file_buf ? 'f' : 'p'))
+      return 5;
+  return 42;
+}
+
+void
+test_main (void)
+{
+  volatile int stack_var = 456;
+  size_t i;
+  pid_t pid;
+  int fd;
+
+  memset (bss_buf, 'p', sizeof bss_buf);
+  memset (file_buf, 'f', sizeof file_buf);
+  CHECK (create ("cow-data", 0), "create \"cow-data\"");
+  CHECK ((fd = open ("cow-data")) > 1, "open \"cow-data\"");
+  CHECK (write (fd, file_buf, sizeof file_buf) == (int) sizeof file_buf,
+         "write \"cow-data\"");
+  close (fd);
+
+  pid = fork ();
+  if (pid == 0)
+    exit (child (&stack_var));
+  CHECK (pid > 0, "fork");
+
+  /* Write to pages shared with the child while it runs. */
+  data_var = 321;
+  stack_var = 654;
+  memset (bss_buf, 'q', 100);
+  CHECK (create ("go", 0), "create \"go\"");
+  CHECK (wait (pid) == 42, "wait for child");
+
+  for (i = 0; i < sizeof bss_buf; i++)
+    if (bss_buf[i] != (i < 100 ? 'q' : 'p'))
+      break;
+  CHECK (data_var == 321 && stack_var == 654 && i == sizeof bss_buf,
+         "parent's memory unchanged by child");
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-cow) begin
+(fork-cow) create "cow-data"
+(fork-cow) open "cow-data"
+(fork-cow) write "cow-data"
+(fork-cow) fork
+(fork-cow) create "go"
+(fork-cow) wait for child
+(fork-cow) parent's memory unchanged by child
+(fork-cow) end
+EOF
+pass;
@@ -0,0 +1,53 @@
+/* Writes from and reads into buffers that span several pages,
+   none of which the process has touched before the system call,
+   and checks that every page of each buffer was transferred. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BUF_SIZE (4096 * 3 + 1234)
+
+/* Each buffer starts partway into a page and ends partway into
+   another.  Only DATA is touched before it is used. */
+static char zeros[BUF_SIZE + 100];
+static char data[BUF_SIZE + 100];
+static char zeros_in[BUF_SIZE + 100];
+static char data_in[BUF_SIZE + 100];
+
+void
+test_main (void)
+{
+  const char *file_name = "rw-test";
+  size_t i;
+  int fd;
+
+  for (i = 0; i < BUF_SIZE; i++)
+    data[i + 100] = i % 251 + i / 4096;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, zeros + 100, BUF_SIZE) == BUF_SIZE,
+         "write %d bytes from untouched buffer", BUF_SIZE);
+  CHECK (write (fd, data + 100, BUF_SIZE) == BUF_SIZE,
+         "write %d bytes of data", BUF_SIZE);
+
+  msg ("seek \"%s\" to 0", file_name);
+  seek (fd, 0);
+  CHECK (read (fd, zeros_in + 100, BUF_SIZE) == BUF_SIZE,
+         "read %d bytes into untouched buffer", BUF_SIZE);
+  CHECK (read (fd, data_in + 100, BUF_SIZE) == BUF_SIZE,
+         "read %d bytes into another untouched buffer", BUF_SIZE);
+  close (fd);
+
+  for (i = 0; i < BUF_SIZE; i++)
+    if (zeros_in[i + 100] != 0)
+      fail ("byte %zu of zeros read back as %d", i, zeros_in[i + 100]);
+  msg ("zeros read back intact");
+  for (i = 0; i < BUF_SIZE; i++)
+    if (data_in[i + 100] != data[i + 100])
+      fail ("byte %zu of data read back as %d instead of %d",
+            i, data_in[i + 100], data[i + 100]);
+  msg ("data read back intact");
+}
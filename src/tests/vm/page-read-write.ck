@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-read-write) begin
+(page-read-write) create "rw-test"
+(page-read-write) open "rw-test"
+(page-read-write) write 13522 bytes from untouched buffer
+(page-read-write) write 13522 bytes of data
+(page-read-write) seek "rw-test" to 0
+(page-read-write) read 13522 bytes into untouched buffer
+(page-read-write) read 13522 bytes into another untouched buffer
+(page-read-write) zeros read back intact
+(page-read-write) data read back intact
+(page-read-write) end
+EOF
+pass;
@@ -0,0 +1,60 @@
+/* Fills 2 MB of memory, more than fits, with a mix of zero
+   pages, sparse pages, and pages of pseudo-random bytes, then
+   checks it twice.  Run with -zswap, so that the zero and sparse
+   pages are swapped out to compressed memory and the others to
+   disk. */
+
+#include <stdint.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 512
+
+static uint8_t buf[PAGE_CNT * PAGE_SIZE];
+
+/* Returns the expected value of the byte at offset OFS in page
+   IDX of buf. */
+static uint8_t
+expected (size_t idx, size_t ofs)
+{
+  switch (idx % 3)
+    {
+    case 0:
+      return 0;
+    case 1:
+      return ofs % 512 == 0 ? (idx + ofs / 512) & 0xff : 0;
+    default:
+      return ((idx * PAGE_SIZE + ofs) * 2654435761u) >> 24;
+    }
+}
+
+/* Checks that buf holds the expected bytes. */
+static void
+check (void)
+{
+  size_t i, j;
+
+  for (i = 0; i < PAGE_CNT; i++)
+    for (j = 0; j < PAGE_SIZE; j++)
+      if (buf[i * PAGE_SIZE + j] != expected (i, j))
+        fail ("byte %zu of page %zu is %d, should be %d",
+              j, i, buf[i * PAGE_SIZE + j], expected (i, j));
+}
+
+void
+test_main (void)
+{
+  size_t i, j;
+
+  msg ("initialize");
+  for (i = 0; i < PAGE_CNT; i++)
+    for (j = 0; j < PAGE_SIZE; j++)
+      buf[i * PAGE_SIZE + j] = expected (i, j);
+
+  msg ("read pass");
+  check ();
+
+  msg ("read pass");
+  check ();
+}
@@ -0,0 +1,84 @@
+#ifndef THREADS_CPU_H
+#define THREADS_CPU_H
+
+#include <stdint.h>
+
+/* CPUID leaf 1 feature flags, in EDX. */
+#define CPUID_EDX_TSC (1 << 4)          /* Time-stamp counter. */
+#define CPUID_EDX_FXSR (1 << 24)        /* FXSAVE and FXRSTOR. */
+#define CPUID_EDX_SSE (1 << 25)         /* SSE. */
+#define CPUID_EDX_SSE2 (1 << 26)        /* SSE2. */
+
+/* CR0 bits. */
+#define CR0_MP 0x00000002               /* Monitor coProcessor. */
+#define CR0_EM 0x00000004               /* (Floating-point) Emulation. */
+#define CR0_TS 0x00000008               /* Task Switched. */
+
+/* CR4 bits. */
+#define CR4_OSFXSR 0x00000200           /* OS supports FXSAVE/FXRSTOR. */
+
+/* Executes CPUID with EAX = LEAF and stores the resulting
+   registers in *EAX, *EBX, *ECX, and *EDX. */
+static inline void
+cpuid (uint32_t leaf, uint32_t *eax, uint32_t *ebx,
+       uint32_t *ecx, uint32_t *edx)
+{
+  /* See [IA32-v2a] "CPUID". */
+  asm volatile ("cpuid"
+                : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+                : "a" (leaf), "c" (0));
+}
+
+/* Returns the CPUID leaf 1 EDX feature flags. */
+static inline uint32_t
+cpuid_features_edx (void)
+{
+  uint32_t eax, ebx, ecx, edx;
+  cpuid (1, &eax, &ebx, &ecx, &edx);
+  return edx;
+}
+
+/* Returns the value of control register CR0. */
+static inline uint32_t
+read_cr0 (void)
+{
+  uint32_t cr0;
+  asm volatile ("movl %%cr0, %0" : "=r" (cr0));
+  return cr0;
+}
+
+/* Sets control register CR0 to CR0. */
+static inline void
+write_cr0 (uint32_t cr0)
+{
+  asm volatile ("movl %0, %%cr0" : : "r" (cr0) : "memory");
+}
+
+/* Returns the value of control register CR4. */
+static inline uint32_t
+read_cr4 (void)
+{
+  uint32_t cr4;
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  return cr4;
+}
+
+/* Sets control register CR4 to CR4. */
+static inline void
+write_cr4 (uint32_t cr4)
+{
+  asm volatile ("movl %0, %%cr4" : : "r" (cr4) : "memory");
+}
+
+/* Reads and returns the time-stamp counter.  The CPU must
+   support the TSC; see CPUID_EDX_TSC. */
+static inline uint64_t
+rdtsc (void)
+{
+  /* See [IA32-v2b] "RDTSC". */
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+#endif /* threads/cpu.h */
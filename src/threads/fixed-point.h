@@ -0,0 +1,34 @@
+#ifndef THREADS_FIXED_POINT_H
+#define THREADS_FIXED_POINT_H
+
+#include <stdint.h>
+
+/* 17.14 fixed-point arithmetic, as used by the 4.4BSD scheduler
+   for recent_cpu and load_avg.  A fixed_t holds a signed real
+   number X as the integer X * FP_F.  See "Fixed-Point Real
+   Arithmetic" in the reference guide for details. */
+typedef int fixed_t;
+
+#define FP_SHIFT 14                     /* Number of fraction bits. */
+#define FP_F (1 << FP_SHIFT)            /* Fixed-point 1. */
+
+/* Converts integer N to fixed point. */
+#define FP_FROM_INT(N) ((fixed_t) ((N) * FP_F))
+
+/* Converts fixed-point X to integer, rounding toward zero. */
+#define FP_TO_INT(X) ((X) / FP_F)
+
+/* Converts fixed-point X to integer, rounding to nearest. */
+#define FP_ROUND(X) ((X) >= 0 ? ((X) + FP_F / 2) / FP_F \
+                              : ((X) - FP_F / 2) / FP_F)
+
+/* Adds integer N to fixed-point X. */
+#define FP_ADD_INT(X, N) ((X) + (N) * FP_F)
+
+/* Multiplies fixed-point X by fixed-point Y. */
+#define FP_MUL(X, Y) ((fixed_t) ((int64_t) (X) * (Y) / FP_F))
+
+/* Divides fixed-point X by fixed-point Y. */
+#define FP_DIV(X, Y) ((fixed_t) ((int64_t) (X) * FP_F / (Y)))
+
+#endif /* threads/fixed-point.h */
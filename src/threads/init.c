@@ -19,6 +19,8 @@
 #include "threads/io.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
+#include "threads/memtrack.h"
+#include "threads/page-ops.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
@@ -35,8 +37,14 @@
 #include "devices/block.h"
 #include "devices/ide.h"
 #include "filesys/filesys.h"
+#include "filesys/cache.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -95,6 +103,7 @@ main (void)
           init_ram_pages * PGSIZE / 1024);
 
   /* Initialize memory system. */
+  page_ops_init ();
   palloc_init (user_page_limit);
   malloc_init ();
   paging_init ();
@@ -114,9 +123,14 @@ main (void)
   exception_init ();
   syscall_init ();
 #endif
+#ifdef VM
+  page_init ();
+  frame_init ();
+#endif
 
   /* Start thread scheduler and enable interrupts. */
   thread_start ();
+  palloc_start_zeroing ();
   serial_init_queue ();
   timer_calibrate ();
 
@@ -127,6 +141,11 @@ main (void)
   filesys_init (format_filesys);
 #endif
 
+#ifdef VM
+  swap_init ();
+  frame_start_cleaning ();
+#endif
+
   printf ("Boot complete.\n");
   
   /* Run actions specified on kernel command line. */
@@ -247,15 +266,23 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-no-readahead"))
+        cache_readahead_enabled = false;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
+      else if (!strcmp (name, "-zswap"))
+        swap_compress = true;
 #endif
 #endif
+      else if (!strcmp (name, "-memstats"))
+        memstats_report = true;
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
@@ -312,6 +339,7 @@ run_actions (char **argv)
 #ifdef FILESYS
       {"ls", 1, fsutil_ls},
       {"cat", 2, fsutil_cat},
+      {"time-read", 2, fsutil_time_read},
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
@@ -360,6 +388,7 @@ usage (void)
 #ifdef FILESYS
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
+          "  time-read FILE     Time a sequential read of FILE.\n"
           "  rm FILE            Delete FILE.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
@@ -373,12 +402,16 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -no-readahead      Disable file system read-ahead.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -zswap             Keep compressible swapped-out pages in memory.\n"
 #endif
 #endif
+          "  -memstats          Print live kernel allocations at shutdown.\n"
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -tickless          Stop the periodic timer tick while idle.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
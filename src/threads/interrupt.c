@@ -359,6 +359,11 @@ intr_handler (struct intr_frame *frame)
 
       in_external_intr = true;
       yield_on_return = false;
+
+      /* If this interrupt ended a tickless idle period, catch up
+         on the timer ticks that were skipped before doing
+         anything else. */
+      timer_idle_exit ();
     }
 
   /* Invoke the interrupt's handler. */
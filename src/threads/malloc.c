@@ -5,17 +5,20 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/memtrack.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
 
-   The size of each request, in bytes, is rounded up to a power
-   of 2 and assigned to the "descriptor" that manages blocks of
-   that size.  The descriptor keeps a list of free blocks.  If
-   the free list is nonempty, one of its blocks is used to
-   satisfy the request.
+   The size of each request, in bytes, is rounded up to the
+   nearest size class and assigned to the "descriptor" that
+   manages blocks of that size.  Size classes go up in steps of
+   16 bytes to 128 bytes, then in steps of about 25%, so that no
+   request wastes more than about a fifth of its block.  The
+   descriptor keeps a list of free blocks.  If the free list is
+   nonempty, one of its blocks is used to satisfy the request.
 
    Otherwise, a new page of memory, called an "arena", is
    obtained from the page allocator (if none is available,
@@ -28,11 +31,11 @@
    blocks, we remove all of the arena's blocks from the free list
    and give the arena back to the page allocator.
 
-   We can't handle blocks bigger than 2 kB using this scheme,
-   because they're too big to fit in a single page with a
-   descriptor.  We handle those by allocating contiguous pages
-   with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   We can't handle blocks bigger than about 2 kB using this
+   scheme, because fewer than two of them fit in a single page
+   with a descriptor.  We handle those by allocating contiguous
+   pages with the page allocator and sticking the allocation size
+   at the beginning of the allocated block's arena header. */
 
 /* Descriptor. */
 struct desc
@@ -41,8 +44,22 @@ struct desc
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
     struct lock lock;           /* Lock. */
+
+    /* Statistics, for the fragmentation report. */
+    size_t in_use;              /* Blocks currently allocated. */
+    size_t arena_cnt;           /* Arenas currently allocated. */
+    unsigned long long alloc_cnt;       /* Blocks ever allocated. */
+    unsigned long long requested;       /* Bytes ever requested. */
   };
 
+/* Size classes below this are spaced SMALL_STEP bytes apart,
+   larger ones about 25% apart. */
+#define SMALL_LIMIT 128
+#define SMALL_STEP 16
+
+/* Largest block size handled by a descriptor. */
+#define MAX_BLOCK_SIZE ((PGSIZE - sizeof (struct arena)) / 2)
+
 /* Magic number for detecting arena corruption. */
 #define ARENA_MAGIC 0x9a548eed
 
@@ -61,9 +78,21 @@ struct block
   };
 
 /* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
+static struct desc descs[32];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Maps a request size, divided by SMALL_STEP and rounded up, to
+   the index in descs of the descriptor that serves it. */
+static uint8_t size_to_desc[PGSIZE / 2 / SMALL_STEP + 1];
+
+/* Statistics for big blocks, protected by big_lock. */
+static struct lock big_lock;
+static size_t big_in_use;               /* Big blocks allocated. */
+static size_t big_pages;                /* Pages in those blocks. */
+static unsigned long long big_alloc_cnt;        /* Big blocks ever. */
+static unsigned long long big_requested;        /* Bytes requested. */
+static unsigned long long big_consumed;         /* Bytes of pages. */
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
 
@@ -71,9 +100,9 @@ static struct block *arena_to_block (struct arena *, size_t idx);
 void
 malloc_init (void) 
 {
-  size_t block_size;
+  size_t block_size, i;
 
-  for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
+  for (block_size = SMALL_STEP; block_size <= MAX_BLOCK_SIZE; )
     {
       struct desc *d = &descs[desc_cnt++];
       ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
@@ -81,7 +110,26 @@ malloc_init (void)
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
       list_init (&d->free_list);
       lock_init (&d->lock);
+      d->in_use = d->arena_cnt = 0;
+      d->alloc_cnt = d->requested = 0;
+
+      if (block_size < SMALL_LIMIT)
+        block_size += SMALL_STEP;
+      else
+        block_size = ROUND_UP (block_size + block_size / 4, SMALL_STEP);
     }
+
+  /* Fill in the lookup table.  Sizes past the largest class map
+     to desc_cnt, meaning a big block. */
+  for (i = 0; i < sizeof size_to_desc; i++)
+    {
+      size_t idx = 0;
+      while (idx < desc_cnt && descs[idx].block_size < i * SMALL_STEP)
+        idx++;
+      size_to_desc[i] = idx;
+    }
+
+  lock_init (&big_lock);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
@@ -99,9 +147,10 @@ malloc (size_t size)
 
   /* Find the smallest descriptor that satisfies a SIZE-byte
      request. */
-  for (d = descs; d < descs + desc_cnt; d++)
-    if (d->block_size >= size)
-      break;
+  if (size <= MAX_BLOCK_SIZE)
+    d = &descs[size_to_desc[DIV_ROUND_UP (size, SMALL_STEP)]];
+  else
+    d = descs + desc_cnt;
   if (d == descs + desc_cnt) 
     {
       /* SIZE is too big for any descriptor.
@@ -111,11 +160,21 @@ malloc (size_t size)
       if (a == NULL)
         return NULL;
 
+      lock_acquire (&big_lock);
+      big_in_use++;
+      big_pages += page_cnt;
+      big_alloc_cnt++;
+      big_requested += size;
+      big_consumed += page_cnt * PGSIZE;
+      lock_release (&big_lock);
+
       /* Initialize the arena to indicate a big block of PAGE_CNT
          pages, and return it. */
       a->magic = ARENA_MAGIC;
       a->desc = NULL;
       a->free_cnt = page_cnt;
+      memtrack_alloc (MEMTRACK_MALLOC, a + 1, size,
+                      __builtin_return_address (0));
       return a + 1;
     }
 
@@ -143,13 +202,18 @@ malloc (size_t size)
           struct block *b = arena_to_block (a, i);
           list_push_back (&d->free_list, &b->free_elem);
         }
+      d->arena_cnt++;
     }
 
   /* Get a block from free list and return it. */
   b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
   a = block_to_arena (b);
   a->free_cnt--;
+  d->in_use++;
+  d->alloc_cnt++;
+  d->requested += size;
   lock_release (&d->lock);
+  memtrack_alloc (MEMTRACK_MALLOC, b, size, __builtin_return_address (0));
   return b;
 }
 
@@ -169,7 +233,10 @@ calloc (size_t a, size_t b)
   /* Allocate and zero memory. */
   p = malloc (size);
   if (p != NULL)
-    memset (p, 0, size);
+    {
+      memset (p, 0, size);
+      memtrack_alloc (MEMTRACK_MALLOC, p, size, __builtin_return_address (0));
+    }
 
   return p;
 }
@@ -190,7 +257,9 @@ block_size (void *block)
    If successful, returns the new block; on failure, returns a
    null pointer.
    A call with null OLD_BLOCK is equivalent to malloc(NEW_SIZE).
-   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK). */
+   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK).
+   If OLD_BLOCK is already at least NEW_SIZE bytes, it is
+   returned unchanged. */
 void *
 realloc (void *old_block, size_t new_size) 
 {
@@ -199,6 +268,12 @@ realloc (void *old_block, size_t new_size)
       free (old_block);
       return NULL;
     }
+  else if (old_block != NULL && block_size (old_block) >= new_size)
+    {
+      memtrack_alloc (MEMTRACK_MALLOC, old_block, new_size,
+                      __builtin_return_address (0));
+      return old_block;
+    }
   else 
     {
       void *new_block = malloc (new_size);
@@ -209,6 +284,8 @@ realloc (void *old_block, size_t new_size)
           memcpy (new_block, old_block, min_size);
           free (old_block);
         }
+      memtrack_alloc (MEMTRACK_MALLOC, new_block, new_size,
+                      __builtin_return_address (0));
       return new_block;
     }
 }
@@ -223,7 +300,9 @@ free (void *p)
       struct block *b = p;
       struct arena *a = block_to_arena (b);
       struct desc *d = a->desc;
-      
+
+      memtrack_free (p);
+
       if (d != NULL) 
         {
           /* It's a normal block.  We handle it here. */
@@ -237,6 +316,7 @@ free (void *p)
 
           /* Add block to free list. */
           list_push_front (&d->free_list, &b->free_elem);
+          d->in_use--;
 
           /* If the arena is now entirely unused, free it. */
           if (++a->free_cnt >= d->blocks_per_arena) 
@@ -250,6 +330,7 @@ free (void *p)
                   list_remove (&b->free_elem);
                 }
               palloc_free_page (a);
+              d->arena_cnt--;
             }
 
           lock_release (&d->lock);
@@ -257,12 +338,65 @@ free (void *p)
       else
         {
           /* It's a big block.  Free its pages. */
+          lock_acquire (&big_lock);
+          big_in_use--;
+          big_pages -= a->free_cnt;
+          lock_release (&big_lock);
           palloc_free_multiple (a, a->free_cnt);
           return;
         }
     }
 }
 
+/* Prints one line of the fragmentation report. */
+static void
+print_frag_line (const char *class, unsigned long long alloc_cnt,
+                 unsigned long long requested, unsigned long long consumed,
+                 size_t in_use, size_t pages)
+{
+  unsigned waste = consumed > 0 ? (consumed - requested) * 100 / consumed : 0;
+  printf ("%6s %10llu %12llu %12llu %4u%% %8zu %6zu\n",
+          class, alloc_cnt, requested, consumed, waste, in_use, pages);
+}
+
+/* Prints a report of internal fragmentation by size class: for
+   the blocks allocated from each class so far, the bytes that
+   were requested versus the bytes of the blocks that held them,
+   along with the blocks and pages each class holds now. */
+void
+malloc_print_stats (void)
+{
+  size_t i;
+
+  printf ("Malloc: %6s %10s %12s %12s %5s %8s %6s\n", "class", "allocs",
+          "requested", "consumed", "waste", "in use", "pages");
+  for (i = 0; i < desc_cnt; i++)
+    {
+      struct desc *d = &descs[i];
+      char class[16];
+
+      lock_acquire (&d->lock);
+      if (d->alloc_cnt > 0)
+        {
+          snprintf (class, sizeof class, "%zu", d->block_size);
+          printf ("Malloc: ");
+          print_frag_line (class, d->alloc_cnt, d->requested,
+                           d->alloc_cnt * d->block_size, d->in_use,
+                           d->arena_cnt);
+        }
+      lock_release (&d->lock);
+    }
+
+  lock_acquire (&big_lock);
+  if (big_alloc_cnt > 0)
+    {
+      printf ("Malloc: ");
+      print_frag_line ("big", big_alloc_cnt, big_requested, big_consumed,
+                       big_in_use, big_pages);
+    }
+  lock_release (&big_lock);
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
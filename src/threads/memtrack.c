@@ -0,0 +1,261 @@
+#include "threads/memtrack.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+
+/* Print a report at shutdown? */
+bool memstats_report;
+
+#ifdef MEMTRACK
+/* Live allocations are kept in a fixed-size hash table, keyed on
+   address, with linear probing.  It is a static array so that
+   tracking never allocates memory itself.  An allocation that
+   would fill the table more than 3/4 full is not tracked, but is
+   counted in untracked_cnt.
+
+   The table is protected by turning off interrupts, because
+   palloc_free_page() is called with interrupts off when a dying
+   thread's page is freed. */
+
+/* Number of slots in the table. */
+#define SLOT_BITS 12
+#define SLOT_CNT (1u << SLOT_BITS)
+
+/* A live allocation. */
+struct alloc_rec
+  {
+    void *ptr;                  /* Address, or null for an empty slot. */
+    void *caller;               /* Return address of allocation call. */
+    unsigned size : 31;         /* Size in bytes. */
+    unsigned kind : 1;          /* enum memtrack_kind. */
+    uint32_t tick;              /* timer_ticks() when allocated. */
+  };
+
+static struct alloc_rec slots[SLOT_CNT];
+static size_t live_cnt;         /* Number of nonempty slots. */
+static size_t untracked_cnt;    /* Allocations not tracked. */
+
+/* Returns the slot that PTR hashes to. */
+static size_t
+home_slot (const void *ptr)
+{
+  return (uint32_t) ((uintptr_t) ptr * 2654435761u) >> (32 - SLOT_BITS);
+}
+
+/* Returns the slot that holds PTR, or the empty slot where it
+   would be inserted. */
+static size_t
+find_slot (const void *ptr)
+{
+  size_t i = home_slot (ptr);
+  while (slots[i].ptr != NULL && slots[i].ptr != ptr)
+    i = (i + 1) % SLOT_CNT;
+  return i;
+}
+
+/* Records that the SIZE-byte allocation P, of the given KIND, was
+   made by the call returning to CALLER.  If P is already
+   recorded, updates its record, so that a wrapper such as
+   calloc() can replace the caller that malloc() recorded. */
+void
+memtrack_alloc (enum memtrack_kind kind, void *p, size_t size, void *caller)
+{
+  enum intr_level old_level;
+  size_t i;
+
+  if (p == NULL)
+    return;
+
+  old_level = intr_disable ();
+  i = find_slot (p);
+  if (slots[i].ptr == NULL)
+    {
+      if (live_cnt >= SLOT_CNT / 4 * 3)
+        {
+          untracked_cnt++;
+          intr_set_level (old_level);
+          return;
+        }
+      live_cnt++;
+    }
+  slots[i].ptr = p;
+  slots[i].caller = caller;
+  slots[i].size = size;
+  slots[i].kind = kind;
+  slots[i].tick = timer_ticks ();
+  intr_set_level (old_level);
+}
+
+/* Forgets the allocation at P, if it was recorded. */
+void
+memtrack_free (void *p)
+{
+  enum intr_level old_level;
+  size_t i, j;
+
+  if (p == NULL)
+    return;
+
+  old_level = intr_disable ();
+  i = find_slot (p);
+  if (slots[i].ptr != NULL)
+    {
+      /* Empty slot I, moving back any later entry in the same
+         probe sequence that would no longer be found. */
+      for (j = (i + 1) % SLOT_CNT; slots[j].ptr != NULL;
+           j = (j + 1) % SLOT_CNT)
+        {
+          size_t home = home_slot (slots[j].ptr);
+          bool movable = (j > i
+                          ? home <= i || home > j
+                          : home <= i && home > j);
+          if (movable)
+            {
+              slots[i] = slots[j];
+              i = j;
+            }
+        }
+      slots[i].ptr = NULL;
+      live_cnt--;
+    }
+  intr_set_level (old_level);
+}
+
+/* Number of top consumers to report. */
+#define TOP_CNT 10
+
+/* Maximum number of live allocations to list. */
+#define LIST_CNT 64
+
+/* Maximum number of distinct callers to total up. */
+#define CONSUMER_CNT 128
+
+/* Total of the live allocations made from one call site. */
+struct consumer
+  {
+    void *caller;               /* Return address of allocation call. */
+    enum memtrack_kind kind;    /* Kind of allocation. */
+    size_t cnt;                 /* Number of live allocations. */
+    size_t bytes;               /* Total bytes. */
+  };
+
+/* Static, since it is too big for a kernel stack. */
+static struct consumer consumers[CONSUMER_CNT];
+
+/* Returns a name for KIND. */
+static const char *
+kind_name (enum memtrack_kind kind)
+{
+  return kind == MEMTRACK_MALLOC ? "malloc" : "palloc";
+}
+
+/* Prints the allocations still live, totaled by call site with
+   the largest first, followed by a list of them, if -memstats
+   was given.  Called at shutdown. */
+void
+memtrack_print_report (void)
+{
+  size_t consumer_cnt = 0;
+  size_t other_cnt = 0, other_bytes = 0;
+  size_t live_bytes = 0;
+  size_t listed = 0;
+  enum intr_level old_level;
+  size_t i, j;
+
+  if (!memstats_report)
+    return;
+
+  old_level = intr_disable ();
+
+  /* Total up by caller. */
+  for (i = 0; i < SLOT_CNT; i++)
+    {
+      struct alloc_rec *r = &slots[i];
+      if (r->ptr == NULL)
+        continue;
+
+      live_bytes += r->size;
+      for (j = 0; j < consumer_cnt; j++)
+        if (consumers[j].caller == r->caller && consumers[j].kind == r->kind)
+          break;
+      if (j == consumer_cnt)
+        {
+          if (consumer_cnt >= CONSUMER_CNT)
+            {
+              other_cnt++;
+              other_bytes += r->size;
+              continue;
+            }
+          consumers[j].caller = r->caller;
+          consumers[j].kind = r->kind;
+          consumers[j].cnt = consumers[j].bytes = 0;
+          consumer_cnt++;
+        }
+      consumers[j].cnt++;
+      consumers[j].bytes += r->size;
+    }
+
+  /* Move the TOP_CNT largest to the front, in order. */
+  for (i = 0; i < TOP_CNT && i < consumer_cnt; i++)
+    {
+      size_t max = i;
+      struct consumer tmp;
+
+      for (j = i + 1; j < consumer_cnt; j++)
+        if (consumers[j].bytes > consumers[max].bytes)
+          max = j;
+      tmp = consumers[i];
+      consumers[i] = consumers[max];
+      consumers[max] = tmp;
+    }
+
+  printf ("Memstats: %zu live allocations, %zu bytes, %zu untracked\n",
+          live_cnt, live_bytes, untracked_cnt);
+  printf ("Memstats: top consumers:\n");
+  for (i = 0; i < TOP_CNT && i < consumer_cnt; i++)
+    printf ("  %8zu bytes in %5zu %s blocks from %p\n",
+            consumers[i].bytes, consumers[i].cnt,
+            kind_name (consumers[i].kind), consumers[i].caller);
+  if (other_cnt > 0)
+    printf ("  %8zu bytes in %5zu blocks from other callers\n",
+            other_bytes, other_cnt);
+
+  printf ("Memstats: live at shutdown:\n");
+  for (i = 0; i < SLOT_CNT && listed < LIST_CNT; i++)
+    {
+      struct alloc_rec *r = &slots[i];
+      if (r->ptr != NULL)
+        {
+          printf ("  %p: %u bytes, %s at tick %"PRIu32" from %p\n",
+                  r->ptr, (unsigned) r->size, kind_name (r->kind),
+                  r->tick, r->caller);
+          listed++;
+        }
+    }
+  if (live_cnt > listed)
+    printf ("  ...and %zu more\n", live_cnt - listed);
+
+  /* Print the top callers in a form that the `backtrace'
+     utility can translate into function names. */
+  printf ("Call stack:");
+  for (i = 0; i < TOP_CNT && i < consumer_cnt; i++)
+    printf (" %p", consumers[i].caller);
+  printf (".\n");
+  printf ("Run `backtrace kernel.o' on the \"Call stack\" line above to "
+          "name the top consumers.\n");
+
+  intr_set_level (old_level);
+}
+#else /* !MEMTRACK */
+/* Explains that no report is available, if -memstats was given. */
+void
+memtrack_print_report (void)
+{
+  if (memstats_report)
+    printf ("Memstats: not available, since the kernel was built "
+            "without MEMTRACK; rebuild with \"make MEMTRACK=1\".\n");
+}
+#endif /* !MEMTRACK */
@@ -0,0 +1,45 @@
+#ifndef THREADS_MEMTRACK_H
+#define THREADS_MEMTRACK_H
+
+#include <debug.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Kernel memory allocation tracking.
+
+   In a kernel built with MEMTRACK defined (run "make
+   MEMTRACK=1"), malloc() and palloc_get_multiple() record the
+   caller, size, and time of each live allocation, and the
+   -memstats kernel command-line option prints a report of them
+   at shutdown.  Otherwise, these functions do nothing. */
+
+/* Kind of allocation. */
+enum memtrack_kind
+  {
+    MEMTRACK_MALLOC,            /* From malloc(), calloc(), realloc(). */
+    MEMTRACK_PALLOC             /* From palloc_get_multiple(). */
+  };
+
+/* Print a report at shutdown?
+   Controlled by kernel command-line option "-memstats". */
+extern bool memstats_report;
+
+#ifdef MEMTRACK
+void memtrack_alloc (enum memtrack_kind, void *, size_t size, void *caller);
+void memtrack_free (void *);
+#else
+static inline void
+memtrack_alloc (enum memtrack_kind kind UNUSED, void *p UNUSED,
+                size_t size UNUSED, void *caller UNUSED)
+{
+}
+
+static inline void
+memtrack_free (void *p UNUSED)
+{
+}
+#endif
+
+void memtrack_print_report (void);
+
+#endif /* threads/memtrack.h */
@@ -0,0 +1,158 @@
+#include "threads/page-ops.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/vaddr.h"
+
+/* Whole-page zeroing and copying.
+
+   When the CPU has SSE2, page_zero() and page_copy() write pages
+   64 bytes per loop iteration with MOVNTDQ, a 16-byte
+   non-temporal store.  Non-temporal stores go around the cache,
+   so zeroing or copying a page does not evict 4 kB of data that
+   is in use in favor of data that the CPU may not touch again
+   soon.  Otherwise, they fall back to memset() and memcpy().
+
+   The kernel runs with CR0.EM set, so that any floating-point or
+   SSE instruction traps, and it does not save FPU state on
+   context switches.  sse_begin() therefore turns off interrupts,
+   so that nothing else can run on the CPU, clears CR0.EM, and
+   saves the FPU and SSE registers with FXSAVE; sse_end()
+   restores the registers and CR0.  Nothing else uses the FPU
+   today, so the save is cheap insurance rather than a
+   necessity. */
+
+/* True if page_zero() and page_copy() use SSE2. */
+static bool use_sse;
+
+/* FPU and SSE register save area for sse_begin() and
+   sse_end().  Only one is needed because interrupts are off
+   while it is in use. */
+static uint8_t fxsave_area[512] __attribute__ ((aligned (16)));
+
+/* Saved CR0 during sse_begin() ... sse_end(). */
+static uint32_t saved_cr0;
+
+/* Detects whether the CPU supports SSE2 and, if so, enables
+   the FXSAVE and FXRSTOR instructions that page_zero() and
+   page_copy() need to save and restore FPU state. */
+void
+page_ops_init (void)
+{
+  uint32_t need = CPUID_EDX_FXSR | CPUID_EDX_SSE | CPUID_EDX_SSE2;
+
+  if ((cpuid_features_edx () & need) != need)
+    {
+      printf ("No SSE2, using scalar page zero and copy.\n");
+      return;
+    }
+
+  /* Setting CR4.OSFXSR alone does not let user programs use SSE,
+     because CR0.EM stays set outside sse_begin() ... sse_end(). */
+  write_cr4 (read_cr4 () | CR4_OSFXSR);
+  use_sse = true;
+  printf ("Using SSE2 for page zero and copy.\n");
+}
+
+/* Returns true if page_zero() and page_copy() use SSE2. */
+bool
+page_ops_use_sse (void)
+{
+  return use_sse;
+}
+
+/* Makes the SSE registers available to the running code, saving
+   their previous contents.  Returns the previous interrupt
+   level, to be passed to sse_end(). */
+static enum intr_level
+sse_begin (void)
+{
+  enum intr_level old_level = intr_disable ();
+
+  saved_cr0 = read_cr0 ();
+  write_cr0 ((saved_cr0 & ~(CR0_EM | CR0_TS)) | CR0_MP);
+  asm volatile ("fxsave %0" : "=m" (fxsave_area));
+  return old_level;
+}
+
+/* Restores the SSE registers saved by sse_begin() and the
+   interrupt level OLD_LEVEL that it returned. */
+static void
+sse_end (enum intr_level old_level)
+{
+  asm volatile ("fxrstor %0" : : "m" (fxsave_area));
+  write_cr0 (saved_cr0);
+  intr_set_level (old_level);
+}
+
+/* Sets the PGSIZE bytes at PAGE, which must be page-aligned, to
+   zero. */
+void
+page_zero (void *page)
+{
+  ASSERT (pg_ofs (page) == 0);
+
+  if (use_sse)
+    {
+      enum intr_level old_level = sse_begin ();
+      uint8_t *p = page;
+      size_t cnt = PGSIZE / 64;
+
+      /* The SSE registers are saved and restored around this, so
+         they need not be declared as clobbered. */
+      asm volatile ("pxor %%xmm0, %%xmm0\n"
+                    "1:\n"
+                    "movntdq %%xmm0, (%0)\n"
+                    "movntdq %%xmm0, 16(%0)\n"
+                    "movntdq %%xmm0, 32(%0)\n"
+                    "movntdq %%xmm0, 48(%0)\n"
+                    "addl $64, %0\n"
+                    "decl %1\n"
+                    "jnz 1b\n"
+                    "sfence"
+                    : "+r" (p), "+r" (cnt) : : "cc", "memory");
+      sse_end (old_level);
+    }
+  else
+    memset (page, 0, PGSIZE);
+}
+
+/* Copies the PGSIZE bytes at SRC to DST.  Both must be
+   page-aligned and must not overlap. */
+void
+page_copy (void *dst, const void *src)
+{
+  ASSERT (pg_ofs (dst) == 0);
+  ASSERT (pg_ofs (src) == 0);
+
+  if (use_sse)
+    {
+      enum intr_level old_level = sse_begin ();
+      uint8_t *d = dst;
+      const uint8_t *s = src;
+      size_t cnt = PGSIZE / 64;
+
+      asm volatile ("1:\n"
+                    "prefetchnta 256(%1)\n"
+                    "movdqa (%1), %%xmm0\n"
+                    "movdqa 16(%1), %%xmm1\n"
+                    "movdqa 32(%1), %%xmm2\n"
+                    "movdqa 48(%1), %%xmm3\n"
+                    "movntdq %%xmm0, (%0)\n"
+                    "movntdq %%xmm1, 16(%0)\n"
+                    "movntdq %%xmm2, 32(%0)\n"
+                    "movntdq %%xmm3, 48(%0)\n"
+                    "addl $64, %0\n"
+                    "addl $64, %1\n"
+                    "decl %2\n"
+                    "jnz 1b\n"
+                    "sfence"
+                    : "+r" (d), "+r" (s), "+r" (cnt) : : "cc", "memory");
+      sse_end (old_level);
+    }
+  else
+    memcpy (dst, src, PGSIZE);
+}
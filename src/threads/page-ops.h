@@ -0,0 +1,11 @@
+#ifndef THREADS_PAGE_OPS_H
+#define THREADS_PAGE_OPS_H
+
+#include <stdbool.h>
+
+void page_ops_init (void);
+bool page_ops_use_sse (void);
+void page_zero (void *page);
+void page_copy (void *dst, const void *src);
+
+#endif /* threads/page-ops.h */
@@ -2,13 +2,18 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
+#include "threads/memtrack.h"
+#include "threads/page-ops.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -25,20 +30,78 @@
    half to the user pool.  That should be huge overkill for the
    kernel pool, but that's just fine for demonstration purposes. */
 
-/* A memory pool. */
+/* Within each pool, free pages are managed by a binary buddy
+   allocator.  A free block of order K is 2**K pages long and
+   starts at a page index that is a multiple of 2**K; its
+   "buddy" is the block of the same order whose index differs
+   from it only in bit K.  A freed block is merged with its buddy
+   whenever the buddy is also free, and a request is satisfied by
+   splitting the smallest free block that is large enough, so
+   both take O(log n) time.  A request for a page count that is
+   not a power of 2 gets its block's unused tail freed again
+   right away.
+
+   The list element that links a free block into its free list is
+   stored in the block's first page, so the only other
+   per-page state is one byte recording the order of the free
+   block that starts at that page, if any.  Unless NDEBUG is
+   defined, the pool also keeps a bitmap of allocated pages, but
+   only to check for double allocations and frees. */
+
+/* To take memset() off the PAL_ZERO allocation path, a
+   low-priority kernel thread keeps a small reserve of single
+   pages that are already zeroed in each pool.  A one-page
+   PAL_ZERO request takes a page from the reserve when there is
+   one.  The reserve is only refilled while the pool has plenty
+   of free pages, and it is given back to the pool whenever an
+   allocation would otherwise fail, so it never costs a caller
+   memory. */
+
+/* Maximum number of pre-zeroed pages kept in a pool. */
+#define ZERO_RESERVE_MAX 32
+
+/* Marks a page that does not begin a free block. */
+#define NOT_FREE 0xff
+
+/* A memory pool.
+   Interrupts, rather than a lock, protect a pool's free lists,
+   because thread_schedule_tail() frees a dying thread's page
+   with interrupts off, where it is not safe to block. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
-    struct bitmap *used_map;            /* Bitmap of free pages. */
+    const char *name;                   /* Name, for statistics. */
+#ifndef NDEBUG
+    struct bitmap *used_map;            /* Bitmap of allocated pages. */
+#endif
+    uint8_t *orders;                    /* Per page: order or NOT_FREE. */
+    struct list free_lists[PALLOC_ORDER_CNT]; /* Free blocks by order. */
+    size_t free_cnt[PALLOC_ORDER_CNT];  /* Number of blocks per list. */
+    size_t page_cnt;                    /* Number of pages. */
     uint8_t *base;                      /* Base of pool. */
+
+    /* Pre-zeroed pages. */
+    struct list zeroed;                 /* Zeroed pages, linked in place. */
+    size_t zeroed_cnt;                  /* Number of pages in zeroed. */
+    size_t zeroed_max;                  /* Size to keep zeroed at. */
+    size_t zero_hits;                   /* PAL_ZERO pages from zeroed. */
+    size_t zero_misses;                 /* PAL_ZERO pages zeroed on demand. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/* Wakes up the zeroing thread.  zero_wanted is true when it has
+   already been woken and has not yet started refilling. */
+static struct semaphore zero_sema;
+static bool zero_wanted;
+
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t alloc_range (struct pool *, size_t page_cnt);
+static void free_range (struct pool *, size_t page_idx, size_t page_cnt);
+static void drain_zeroed (struct pool *);
+static thread_func zero_thread;
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -59,6 +122,15 @@ palloc_init (size_t user_page_limit)
   init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
   init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
              user_pages, "user pool");
+  sema_init (&zero_sema, 0);
+}
+
+/* Starts the thread that keeps the pools' reserves of zeroed
+   pages filled.  Must be called after thread_start(). */
+void
+palloc_start_zeroing (void)
+{
+  thread_create ("pzero", PRI_MIN, zero_thread, NULL);
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -71,25 +143,59 @@ void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
-  void *pages;
+  enum intr_level old_level;
+  void *pages = NULL;
+  bool zeroed = false;
+  bool wake = false;
   size_t page_idx;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
-
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
+  old_level = intr_disable ();
+  if (page_cnt == 1 && (flags & PAL_ZERO) && !list_empty (&pool->zeroed))
+    {
+      pages = list_pop_front (&pool->zeroed);
+      pool->zeroed_cnt--;
+      zeroed = true;
+    }
   else
-    pages = NULL;
+    {
+      page_idx = alloc_range (pool, page_cnt);
+      if (page_idx == BITMAP_ERROR && pool->zeroed_cnt > 0)
+        {
+          drain_zeroed (pool);
+          page_idx = alloc_range (pool, page_cnt);
+        }
+      if (page_idx != BITMAP_ERROR)
+        pages = pool->base + PGSIZE * page_idx;
+    }
+  if (flags & PAL_ZERO)
+    {
+      if (zeroed)
+        pool->zero_hits += page_cnt;
+      else
+        pool->zero_misses += page_cnt;
+      if (pool->zeroed_cnt < pool->zeroed_max && !zero_wanted)
+        wake = zero_wanted = true;
+    }
+  intr_set_level (old_level);
+
+  if (wake)
+    sema_up (&zero_sema);
 
   if (pages != NULL) 
     {
-      if (flags & PAL_ZERO)
-        memset (pages, 0, PGSIZE * page_cnt);
+      if (zeroed)
+        memset (pages, 0, sizeof (struct list_elem));
+      else if (flags & PAL_ZERO)
+        {
+          size_t i;
+          for (i = 0; i < page_cnt; i++)
+            page_zero ((uint8_t *) pages + PGSIZE * i);
+        }
+      memtrack_alloc (MEMTRACK_PALLOC, pages, PGSIZE * page_cnt,
+                      __builtin_return_address (0));
     }
   else 
     {
@@ -110,7 +216,10 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 void *
 palloc_get_page (enum palloc_flags flags) 
 {
-  return palloc_get_multiple (flags, 1);
+  void *page = palloc_get_multiple (flags, 1);
+  memtrack_alloc (MEMTRACK_PALLOC, page, PGSIZE,
+                  __builtin_return_address (0));
+  return page;
 }
 
 /* Frees the PAGE_CNT pages starting at PAGES. */
@@ -118,6 +227,7 @@ void
 palloc_free_multiple (void *pages, size_t page_cnt) 
 {
   struct pool *pool;
+  enum intr_level old_level;
   size_t page_idx;
 
   ASSERT (pg_ofs (pages) == 0);
@@ -132,13 +242,19 @@ palloc_free_multiple (void *pages, size_t page_cnt)
     NOT_REACHED ();
 
   page_idx = pg_no (pages) - pg_no (pool->base);
+  memtrack_free (pages);
 
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  old_level = intr_disable ();
+#ifndef NDEBUG
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+#endif
+  free_range (pool, page_idx, page_cnt);
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -148,15 +264,84 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Copies the number of free blocks of each order in the user
+   pool, if PAL_USER is set in FLAGS, or the kernel pool
+   otherwise, into CNTS. */
+void
+palloc_free_counts (enum palloc_flags flags, size_t cnts[PALLOC_ORDER_CNT])
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  memcpy (cnts, pool->free_cnt, sizeof pool->free_cnt);
+  intr_set_level (old_level);
+}
+
+/* Returns the number of free pages in POOL's free lists. */
+static size_t
+free_pages (const struct pool *pool)
+{
+  size_t cnt = 0;
+  int order;
+
+  for (order = 0; order < PALLOC_ORDER_CNT; order++)
+    cnt += pool->free_cnt[order] << order;
+  return cnt;
+}
+
+/* Prints the free pages in POOL and how they are split up. */
+static void
+print_pool_stats (struct pool *pool)
+{
+  size_t cnts[PALLOC_ORDER_CNT];
+  size_t free_cnt, zeroed_cnt, hits, requests;
+  enum intr_level old_level;
+  int order;
+
+  old_level = intr_disable ();
+  memcpy (cnts, pool->free_cnt, sizeof cnts);
+  free_cnt = free_pages (pool);
+  zeroed_cnt = pool->zeroed_cnt;
+  hits = pool->zero_hits;
+  requests = pool->zero_hits + pool->zero_misses;
+  intr_set_level (old_level);
+
+  printf ("%s: %zu of %zu pages free, free blocks by order:",
+          pool->name, free_cnt + zeroed_cnt, pool->page_cnt);
+  for (order = 0; order < PALLOC_ORDER_CNT; order++)
+    if (cnts[order] > 0)
+      printf (" %d:%zu", order, cnts[order]);
+  printf (", %zu pre-zeroed\n", zeroed_cnt);
+  printf ("%s: %zu zeroed pages requested, %zu (%zu%%) pre-zeroed\n",
+          pool->name, requests, hits,
+          requests > 0 ? hits * 100 / requests : 0);
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void)
+{
+  print_pool_stats (&kernel_pool);
+  print_pool_stats (&user_pool);
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  /* We'll put the pool's used_map, if any, and orders at its
+     base.  Calculate the space needed for them and subtract it
+     from the pool's size. */
+#ifndef NDEBUG
+  size_t bm_size = bitmap_buf_size (page_cnt);
+#else
+  size_t bm_size = 0;
+#endif
+  size_t bm_pages = DIV_ROUND_UP (bm_size + page_cnt, PGSIZE);
+  int order;
+
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -164,9 +349,27 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
   /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  p->name = name;
+#ifndef NDEBUG
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+#endif
+  p->orders = (uint8_t *) base + bm_size;
+  memset (p->orders, NOT_FREE, page_cnt);
+  for (order = 0; order < PALLOC_ORDER_CNT; order++)
+    {
+      list_init (&p->free_lists[order]);
+      p->free_cnt[order] = 0;
+    }
+  p->page_cnt = page_cnt;
+  p->base = (uint8_t *) base + bm_pages * PGSIZE;
+  list_init (&p->zeroed);
+  p->zeroed_cnt = 0;
+  p->zeroed_max = page_cnt / 16 < ZERO_RESERVE_MAX ? page_cnt / 16
+                                                    : ZERO_RESERVE_MAX;
+  p->zero_hits = p->zero_misses = 0;
+
+  /* Put all the pages on the free lists. */
+  free_range (p, 0, page_cnt);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -176,7 +379,192 @@ page_from_pool (const struct pool *pool, void *page)
 {
   size_t page_no = pg_no (page);
   size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t end_page = start_page + pool->page_cnt;
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Returns the list element stored in the first page of the
+   block at PAGE_IDX in POOL. */
+static struct list_elem *
+block_elem (const struct pool *pool, size_t page_idx)
+{
+  return (struct list_elem *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Returns the page index of the block whose list element is
+   ELEM in POOL. */
+static size_t
+elem_block (const struct pool *pool, const struct list_elem *elem)
+{
+  return ((const uint8_t *) elem - pool->base) / PGSIZE;
+}
+
+/* Adds the block of order ORDER at PAGE_IDX to POOL's free
+   lists. */
+static void
+push_block (struct pool *pool, size_t page_idx, int order)
+{
+  pool->orders[page_idx] = order;
+  list_push_front (&pool->free_lists[order], block_elem (pool, page_idx));
+  pool->free_cnt[order]++;
+}
+
+/* Removes the block of order ORDER at PAGE_IDX from POOL's free
+   lists. */
+static void
+remove_block (struct pool *pool, size_t page_idx, int order)
+{
+  ASSERT (pool->orders[page_idx] == order);
+  list_remove (block_elem (pool, page_idx));
+  pool->orders[page_idx] = NOT_FREE;
+  pool->free_cnt[order]--;
+}
+
+/* Frees the block of order ORDER at PAGE_IDX in POOL, merging it
+   with its buddy for as long as the buddy is free. */
+static void
+free_block (struct pool *pool, size_t page_idx, int order)
+{
+  while (order + 1 < PALLOC_ORDER_CNT)
+    {
+      size_t buddy_idx = page_idx ^ ((size_t) 1 << order);
+      if (buddy_idx + ((size_t) 1 << order) > pool->page_cnt
+          || pool->orders[buddy_idx] != order)
+        break;
+
+      remove_block (pool, buddy_idx, order);
+      page_idx &= ~((size_t) 1 << order);
+      order++;
+    }
+  push_block (pool, page_idx, order);
+}
+
+/* Frees the PAGE_CNT pages starting at PAGE_IDX in POOL, by
+   splitting them into the largest aligned blocks that fit. */
+static void
+free_range (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  size_t end = page_idx + page_cnt;
+
+  while (page_idx < end)
+    {
+      int order = 0;
+      while (order + 1 < PALLOC_ORDER_CNT
+             && page_idx % ((size_t) 2 << order) == 0
+             && page_idx + ((size_t) 2 << order) <= end)
+        order++;
+      free_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+    }
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first, or BITMAP_ERROR if no large enough block
+   is free. */
+static size_t
+alloc_range (struct pool *pool, size_t page_cnt)
+{
+  int want, order;
+  size_t page_idx;
+
+  /* Find the smallest order that is big enough. */
+  for (want = 0; ((size_t) 1 << want) < page_cnt; want++)
+    if (want + 1 >= PALLOC_ORDER_CNT)
+      return BITMAP_ERROR;
+
+  /* Take the smallest free block at least that big. */
+  for (order = want; order < PALLOC_ORDER_CNT; order++)
+    if (!list_empty (&pool->free_lists[order]))
+      break;
+  if (order >= PALLOC_ORDER_CNT)
+    return BITMAP_ERROR;
+  page_idx = elem_block (pool, list_front (&pool->free_lists[order]));
+  remove_block (pool, page_idx, order);
+
+  /* Split it down to the order we want, freeing the upper
+     halves. */
+  while (order > want)
+    {
+      order--;
+      push_block (pool, page_idx + ((size_t) 1 << order), order);
+    }
+
+  /* Give back the pages past PAGE_CNT. */
+  if (page_cnt < (size_t) 1 << want)
+    free_range (pool, page_idx + page_cnt,
+                ((size_t) 1 << want) - page_cnt);
+
+#ifndef NDEBUG
+  ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+#endif
+  return page_idx;
+}
+
+/* Returns all of POOL's pre-zeroed pages to its free lists.
+   Interrupts must be off. */
+static void
+drain_zeroed (struct pool *pool)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (!list_empty (&pool->zeroed))
+    {
+      size_t page_idx = elem_block (pool, list_pop_front (&pool->zeroed));
+#ifndef NDEBUG
+      bitmap_reset (pool->used_map, page_idx);
+#endif
+      free_range (pool, page_idx, 1);
+    }
+  pool->zeroed_cnt = 0;
+}
+
+/* Zeroes free pages from POOL and adds them to its reserve until
+   the reserve is full or the pool runs low on free pages. */
+static void
+refill_zeroed (struct pool *pool)
+{
+  for (;;)
+    {
+      enum intr_level old_level;
+      size_t page_idx;
+      void *page;
+
+      old_level = intr_disable ();
+      if (pool->zeroed_cnt >= pool->zeroed_max
+          || free_pages (pool) <= 2 * pool->zeroed_max)
+        page_idx = BITMAP_ERROR;
+      else
+        page_idx = alloc_range (pool, 1);
+      intr_set_level (old_level);
+      if (page_idx == BITMAP_ERROR)
+        break;
+
+      page = pool->base + PGSIZE * page_idx;
+      page_zero (page);
+
+      old_level = intr_disable ();
+      list_push_back (&pool->zeroed, page);
+      pool->zeroed_cnt++;
+      intr_set_level (old_level);
+    }
+}
+
+/* Thread function for the zeroing thread.  Refills both pools'
+   reserves, then waits until a PAL_ZERO request finds one short
+   again. */
+static void
+zero_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      enum intr_level old_level = intr_disable ();
+      zero_wanted = false;
+      intr_set_level (old_level);
+
+      refill_zeroed (&kernel_pool);
+      refill_zeroed (&user_pool);
+      sema_down (&zero_sema);
+    }
+}
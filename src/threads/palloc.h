@@ -11,10 +11,18 @@ enum palloc_flags
     PAL_USER = 004              /* User page. */
   };
 
+/* Number of buddy allocator block orders.  A block of order K is
+   2**K pages, so this limits a single allocation to
+   2**(PALLOC_ORDER_CNT - 1) pages. */
+#define PALLOC_ORDER_CNT 16
+
 void palloc_init (size_t user_page_limit);
+void palloc_start_zeroing (void);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+void palloc_free_counts (enum palloc_flags, size_t cnts[PALLOC_ORDER_CNT]);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
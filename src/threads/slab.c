@@ -0,0 +1,298 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Slab allocator for objects of a fixed type.
+
+   malloc() rounds each request up to a power of 2, which wastes
+   up to half of every block for structures whose size falls just
+   past a power of 2, and all structures of similar size share one
+   descriptor lock.  A kmem_cache instead serves objects of one
+   exact size (rounded up only to SLAB_ALIGN) from its own pages,
+   called "slabs", under its own lock.
+
+   Each slab is one page with a struct slab header at its start,
+   followed by as many objects as fit.  Free objects in a slab
+   are kept on a singly linked list threaded through the objects
+   themselves.  A cache keeps its slabs on three lists according
+   to whether they are partly used, completely used, or unused.
+   At most one unused slab is kept; the page of any other unused
+   slab is returned to the page allocator.
+
+   If a cache has a constructor, it is run on each object once,
+   when the object's slab is created, rather than on every
+   allocation.  Objects must therefore be freed in their
+   constructed state, e.g. with any lock they contain released.
+   So that the free list does not overwrite constructed state,
+   the free list link for such a cache goes in an extra word
+   just past the end of each object. */
+
+/* Alignment of objects. */
+#define SLAB_ALIGN 8
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Object cache. */
+struct kmem_cache
+  {
+    struct list_elem elem;      /* Element in all_caches. */
+    const char *name;           /* Name, for statistics. */
+    size_t size;                /* Object size requested. */
+    size_t stride;              /* Bytes from one object to the next. */
+    size_t link_ofs;            /* Offset of free list link in object. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    kmem_ctor_func *ctor;       /* Constructor, or null. */
+
+    struct lock lock;           /* Protects everything below. */
+    struct list partial;        /* Slabs with used and free objects. */
+    struct list full;           /* Slabs with no free objects. */
+    struct list empty;          /* Slabs with no used objects. */
+
+    /* Statistics. */
+    size_t slab_cnt;            /* Number of slabs. */
+    size_t in_use;              /* Number of objects allocated. */
+    size_t peak_in_use;         /* Maximum of in_use. */
+    unsigned long long alloc_cnt;  /* Calls to kmem_cache_alloc(). */
+    unsigned long long free_cnt;   /* Calls to kmem_cache_free(). */
+  };
+
+/* Slab header, at the start of each slab's page. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in one of cache's lists. */
+    size_t in_use;              /* Number of allocated objects. */
+    void *free;                 /* First free object, or null. */
+  };
+
+/* Offset of the first object in a slab. */
+#define SLAB_OBJS_OFS ROUND_UP (sizeof (struct slab), SLAB_ALIGN)
+
+/* All caches, for statistics. */
+static struct list all_caches = LIST_INITIALIZER (all_caches);
+
+/* Returns a pointer to the free list link in OBJ, an object in
+   cache C. */
+static inline void **
+obj_link (const struct kmem_cache *c, void *obj)
+{
+  return (void **) ((uint8_t *) obj + c->link_ofs);
+}
+
+/* Returns the slab that OBJ, an object in cache C, is in. */
+static struct slab *
+obj_to_slab (const struct kmem_cache *c, void *obj)
+{
+  struct slab *s = pg_round_down (obj);
+
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+  ASSERT ((pg_ofs (obj) - SLAB_OBJS_OFS) % c->stride == 0);
+  return s;
+}
+
+/* Creates and returns a cache for objects of SIZE bytes, named
+   NAME for statistics.  If CTOR is nonnull, it is run on each
+   object when the object is first made available; see the
+   comment at the top of this file.  Panics if memory is not
+   available, since caches are created at initialization time. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, kmem_ctor_func *ctor)
+{
+  struct kmem_cache *c;
+
+  ASSERT (size > 0);
+
+  c = malloc (sizeof *c);
+  if (c == NULL)
+    PANIC ("%s: out of memory creating object cache", name);
+
+  c->name = name;
+  c->size = size;
+  c->ctor = ctor;
+  if (ctor != NULL)
+    {
+      c->link_ofs = ROUND_UP (size, sizeof (void *));
+      c->stride = ROUND_UP (c->link_ofs + sizeof (void *), SLAB_ALIGN);
+    }
+  else
+    {
+      c->link_ofs = 0;
+      c->stride = ROUND_UP (size < sizeof (void *) ? sizeof (void *) : size,
+                            SLAB_ALIGN);
+    }
+  c->objs_per_slab = (PGSIZE - SLAB_OBJS_OFS) / c->stride;
+  if (c->objs_per_slab == 0)
+    PANIC ("%s: %zu-byte objects are too big for a slab", name, size);
+
+  lock_init (&c->lock);
+  list_init (&c->partial);
+  list_init (&c->full);
+  list_init (&c->empty);
+  c->slab_cnt = 0;
+  c->in_use = c->peak_in_use = 0;
+  c->alloc_cnt = c->free_cnt = 0;
+
+  list_push_back (&all_caches, &c->elem);
+  return c;
+}
+
+/* Allocates a new slab for cache C and returns it, or returns a
+   null pointer if no page is available. */
+static struct slab *
+slab_create (struct kmem_cache *c)
+{
+  struct slab *s;
+  uint8_t *obj;
+  size_t i;
+
+  s = palloc_get_page (0);
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->in_use = 0;
+  s->free = NULL;
+
+  /* Build the free list back to front, so that objects are
+     handed out in address order. */
+  obj = (uint8_t *) s + SLAB_OBJS_OFS + c->objs_per_slab * c->stride;
+  for (i = 0; i < c->objs_per_slab; i++)
+    {
+      obj -= c->stride;
+      if (c->ctor != NULL)
+        c->ctor (obj);
+      *obj_link (c, obj) = s->free;
+      s->free = obj;
+    }
+
+  c->slab_cnt++;
+  return s;
+}
+
+/* Allocates and returns an object from cache C.  The object is
+   in the state that C's constructor leaves it in, if C has one,
+   otherwise its contents are undefined.  Returns a null pointer
+   if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  lock_acquire (&c->lock);
+
+  /* Find a slab with a free object, preferring partly used slabs
+     so that unused ones can be given back. */
+  if (!list_empty (&c->partial))
+    s = list_entry (list_front (&c->partial), struct slab, elem);
+  else
+    {
+      if (!list_empty (&c->empty))
+        s = list_entry (list_pop_front (&c->empty), struct slab, elem);
+      else
+        {
+          s = slab_create (c);
+          if (s == NULL)
+            {
+              lock_release (&c->lock);
+              return NULL;
+            }
+        }
+      list_push_front (&c->partial, &s->elem);
+    }
+
+  /* Take the object. */
+  obj = s->free;
+  s->free = *obj_link (c, obj);
+  if (++s->in_use == c->objs_per_slab)
+    {
+      list_remove (&s->elem);
+      list_push_front (&c->full, &s->elem);
+    }
+
+  c->alloc_cnt++;
+  if (++c->in_use > c->peak_in_use)
+    c->peak_in_use = c->in_use;
+
+  lock_release (&c->lock);
+  return obj;
+}
+
+/* Returns OBJ, which must have been allocated from cache C, to
+   C.  If C has a constructor, OBJ must be in its constructed
+   state. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+
+  if (obj == NULL)
+    return;
+
+  s = obj_to_slab (c, obj);
+
+#ifndef NDEBUG
+  /* Clear the object to help detect use-after-free bugs, unless
+     that would destroy its constructed state. */
+  if (c->ctor == NULL)
+    memset (obj, 0xcc, c->size);
+#endif
+
+  lock_acquire (&c->lock);
+
+  ASSERT (s->in_use > 0);
+  *obj_link (c, obj) = s->free;
+  s->free = obj;
+  if (s->in_use-- == c->objs_per_slab)
+    {
+      list_remove (&s->elem);
+      list_push_front (&c->partial, &s->elem);
+    }
+  if (s->in_use == 0)
+    {
+      /* Keep one unused slab to absorb alloc/free churn, and give
+         any others back to the page allocator. */
+      list_remove (&s->elem);
+      if (list_empty (&c->empty))
+        list_push_front (&c->empty, &s->elem);
+      else
+        {
+          c->slab_cnt--;
+          palloc_free_page (s);
+        }
+    }
+
+  c->free_cnt++;
+  c->in_use--;
+
+  lock_release (&c->lock);
+}
+
+/* Prints statistics for each object cache. */
+void
+kmem_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&all_caches); e != list_end (&all_caches);
+       e = list_next (e))
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+      printf ("Slab %s: %zu-byte objects, %zu in use (peak %zu), "
+              "%zu slabs of %zu, %llu allocs, %llu frees\n",
+              c->name, c->size, c->in_use, c->peak_in_use,
+              c->slab_cnt, c->objs_per_slab, c->alloc_cnt, c->free_cnt);
+    }
+}
@@ -219,8 +219,8 @@ lock_acquire (struct lock *lock)
 
   int max_pri = lock->holder->priority;
 
-  /* daca lock-ul este deja folosit */
-  if(lock->semaphore.value == 0)
+  /* daca lock-ul este deja folosit (MLFQS nu foloseste donarea de prioritate) */
+  if(lock->semaphore.value == 0 && !thread_mlfqs)
   {
     /*  Check to see if a donated priority is higher than the innate priority */
     if(!list_empty(&lock->holder->donated_priorities))
@@ -243,9 +243,13 @@ lock_acquire (struct lock *lock)
             {
               struct thread *child_thread = list_entry (ee, struct thread, recp_elem);
               list_insert_ordered(&child_thread->donated_priorities, &thread_current()->pri_elem, thread_priority_compare_donated, NULL);
+              thread_requeue(child_thread);
             }
           }
           list_insert_ordered(&cur_thread->donated_priorities, &thread_current()->pri_elem, thread_priority_compare_donated, NULL);
+
+          /* Muta thread-ul in coada noii sale prioritati, daca este READY */
+          thread_requeue(cur_thread);
         }
       }
       /* Prioritizeaza thread-urile */
@@ -11,6 +11,7 @@
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
@@ -20,9 +21,17 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Run queues of processes in THREAD_READY state, that is,
+   processes that are ready to run but not actually running.
+   There is one FIFO queue per priority level, indexed by the
+   effective priority the thread had when it was queued. */
+static struct list ready_queues[PRI_MAX + 1];
+
+/* Bit P is set if and only if ready_queues[P] is nonempty. */
+static uint64_t ready_bitmap;
+
+/* Number of threads in all of the run queues. */
+static size_t ready_cnt;
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -49,11 +58,16 @@ struct kernel_thread_frame
 static long long idle_ticks;   /* # of timer ticks spent idle. */
 static long long kernel_ticks; /* # of timer ticks in kernel threads. */
 static long long user_ticks;   /* # of timer ticks in user programs. */
+static long long idle_wakeups; /* # of times the idle thread woke up. */
+static long long idle_tickless; /* # of idle periods without a periodic tick. */
 
 /* Scheduling. */
 #define TIME_SLICE 4          /* # of timer ticks to give each thread. */
 static unsigned thread_ticks; /* # of timer ticks since last yield. */
 
+/* MLFQS scheduling. */
+static fixed_t load_avg;      /* System load average. */
+
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
@@ -70,6 +84,13 @@ static void *alloc_frame(struct thread *, size_t size);
 static void schedule(void);
 void thread_schedule_tail(struct thread *prev);
 static tid_t allocate_tid(void);
+static void ready_queue_push(struct thread *);
+static void ready_queue_remove(struct thread *);
+static int ready_queue_highest(void);
+static void mlfqs_tick(struct thread *);
+static void mlfqs_update_priority(struct thread *);
+static int mlfqs_priority(const struct thread *);
+static void mlfqs_update_thread(struct thread *, void *aux);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -86,10 +107,15 @@ static tid_t allocate_tid(void);
    finishes. */
 void thread_init(void)
 {
+  int pri;
+
   ASSERT(intr_get_level() == INTR_OFF);
 
   lock_init(&tid_lock);
-  list_init(&ready_list);
+  for (pri = PRI_MIN; pri <= PRI_MAX; pri++)
+    list_init(&ready_queues[pri]);
+  ready_bitmap = 0;
+  ready_cnt = 0;
   list_init(&all_list);
 
   /* Set up a thread structure for the running thread. */
@@ -131,6 +157,9 @@ void thread_tick(void)
   else
     kernel_ticks++;
 
+  if (thread_mlfqs)
+    mlfqs_tick(t);
+
   /* Enforce preemption. */
   if (++thread_ticks >= TIME_SLICE)
     intr_yield_on_return();
@@ -141,6 +170,7 @@ void thread_print_stats(void)
 {
   printf("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
          idle_ticks, kernel_ticks, user_ticks);
+  printf("Idle: %lld wakeups, %lld tickless\n", idle_wakeups, idle_tickless);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -240,10 +270,8 @@ void thread_unblock(struct thread *t)
   old_level = intr_disable();
   ASSERT(t->status == THREAD_BLOCKED);
 
-  list_push_back(&ready_list, &t->elem);
-  
-  /* Adauga thread-ul in ready list in ordinea prioritatilor si ii schimba status-ul in READY */
-  list_insert_ordered(&ready_list, &t->elem, thread_priority_compare, NULL);
+  /* Adauga thread-ul in coada prioritatii sale si ii schimba status-ul in READY */
+  ready_queue_push(t);
   t->status = THREAD_READY;
 
   intr_set_level(old_level);
@@ -316,10 +344,8 @@ void thread_yield(void)
   old_level = intr_disable();
   if (cur != idle_thread)
   {
-    list_push_back(&ready_list, &cur->elem);
-
-    /* Insereaza tread-ul ce cedeaza prioritate in ready list dupa prioritatea curenta */
-    list_insert_ordered(&ready_list, &cur->elem, thread_priority_compare, NULL);
+    /* Insereaza tread-ul ce cedeaza prioritate la finalul cozii prioritatii curente */
+    ready_queue_push(cur);
   }
   cur->status = THREAD_READY;
   schedule();
@@ -345,19 +371,24 @@ void thread_foreach(thread_action_func *func, void *aux)
 /* Sets the current thread's priority to NEW_PRIORITY. */
 void thread_set_priority(int new_priority)
 {
+  /* The MLFQS scheduler computes priorities itself. */
+  if (thread_mlfqs)
+    return;
+
   thread_current()->priority = new_priority;
 
   /* Adevarat in cazul exista in lista si trebuie verificata prioritatea. */
   bool check_priority = false;
 
-  /* Urmatorul thread din lista dupa prioritate (lista este sortata). */
+  /* Primul thread din coada cu cea mai mare prioritate. */
   struct thread *next_thread;
 
   enum intr_level old_level = intr_disable();
 
-  if (list_size(&ready_list) > 0)
+  if (ready_cnt > 0)
   {
-    next_thread = list_entry(list_front(&ready_list), struct thread, elem);
+    next_thread = list_entry(list_front(&ready_queues[ready_queue_highest()]),
+                             struct thread, elem);
     check_priority = true;
   }
 
@@ -386,31 +417,124 @@ int thread_get_priority(void)
   return thread_current()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
-void thread_set_nice(int nice UNUSED)
+/* Sets the current thread's nice value to NICE, recomputes its
+   priority, and yields if it no longer has the highest priority. */
+void thread_set_nice(int nice)
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current();
+  enum intr_level old_level;
+  bool yield;
+
+  ASSERT(NICE_MIN <= nice && nice <= NICE_MAX);
+
+  old_level = intr_disable();
+  cur->nice = nice;
+  if (thread_mlfqs)
+    mlfqs_update_priority(cur);
+  yield = ready_cnt > 0 && ready_queue_highest() > cur->priority;
+  intr_set_level(old_level);
+
+  if (yield)
+    thread_yield();
 }
 
 /* Returns the current thread's nice value. */
 int thread_get_nice(void)
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int thread_get_load_avg(void)
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable();
+  int load_avg_100 = FP_ROUND(load_avg * 100);
+  intr_set_level(old_level);
+
+  return load_avg_100;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int thread_get_recent_cpu(void)
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable();
+  int recent_cpu_100 = FP_ROUND(thread_current()->recent_cpu * 100);
+  intr_set_level(old_level);
+
+  return recent_cpu_100;
+}
+
+/* MLFQS bookkeeping for one timer tick, with T running.
+
+   Only the running thread's recent_cpu changes from tick to
+   tick, so between once-per-second updates only T's priority
+   needs to be recomputed.  Once per second, load_avg and every
+   thread's recent_cpu and priority are recomputed and ready
+   threads are moved to their new run queues.  Runs in the timer
+   interrupt handler. */
+static void
+mlfqs_tick(struct thread *t)
+{
+  int64_t now = timer_ticks();
+
+  if (t != idle_thread)
+    t->recent_cpu = FP_ADD_INT(t->recent_cpu, 1);
+
+  if (now % TIMER_FREQ == 0)
+  {
+    int ready_threads = ready_cnt + (t != idle_thread ? 1 : 0);
+
+    load_avg = FP_MUL(FP_DIV(FP_FROM_INT(59), FP_FROM_INT(60)), load_avg)
+               + FP_FROM_INT(ready_threads) / 60;
+    thread_foreach(mlfqs_update_thread, NULL);
+  }
+  else if (now % TIME_SLICE == 0)
+    mlfqs_update_priority(t);
+
+  if (ready_cnt > 0 && ready_queue_highest() > t->priority)
+    intr_yield_on_return();
+}
+
+/* Recomputes T's priority from its recent_cpu and nice values,
+   moving T to the matching run queue if it is ready. */
+static void
+mlfqs_update_priority(struct thread *t)
+{
+  if (t == idle_thread)
+    return;
+
+  t->priority = mlfqs_priority(t);
+  thread_requeue(t);
+}
+
+/* Returns the MLFQS priority for T's recent_cpu and nice values,
+   clamped to the valid range. */
+static int
+mlfqs_priority(const struct thread *t)
+{
+  int priority = PRI_MAX - FP_TO_INT(t->recent_cpu / 4) - t->nice * 2;
+
+  if (priority < PRI_MIN)
+    return PRI_MIN;
+  else if (priority > PRI_MAX)
+    return PRI_MAX;
+  return priority;
+}
+
+/* Once-per-second recent_cpu decay for thread T, followed by a
+   priority recomputation.  Called via thread_foreach(). */
+static void
+mlfqs_update_thread(struct thread *t, void *aux UNUSED)
+{
+  fixed_t twice_load = load_avg * 2;
+
+  if (t == idle_thread)
+    return;
+
+  t->recent_cpu = FP_ADD_INT(FP_MUL(FP_DIV(twice_load, FP_ADD_INT(twice_load, 1)),
+                                    t->recent_cpu),
+                             t->nice);
+  mlfqs_update_priority(t);
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -435,6 +559,11 @@ idle(void *idle_started_ UNUSED)
     intr_disable();
     thread_block();
 
+    /* Stop the periodic tick, if enabled, until the next
+       sleeping thread is due. */
+    if (timer_idle_enter())
+      idle_tickless++;
+
     /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -451,6 +580,7 @@ idle(void *idle_started_ UNUSED)
                  :
                  :
                  : "memory");
+    idle_wakeups++;
   }
 }
 
@@ -503,6 +633,24 @@ init_thread(struct thread *t, const char *name, int priority)
   t->priority = priority;
   t->magic = THREAD_MAGIC;
 
+  /* Under MLFQS the priority argument is ignored: a new thread
+     inherits its parent's niceness and recent CPU time, and its
+     priority is computed from them. */
+  if (thread_mlfqs)
+  {
+    if (t != running_thread())
+    {
+      t->nice = running_thread()->nice;
+      t->recent_cpu = running_thread()->recent_cpu;
+    }
+    else
+    {
+      t->nice = NICE_DEFAULT;
+      t->recent_cpu = 0;
+    }
+    t->priority = mlfqs_priority(t);
+  }
+
     /* Initialize the donated_priorities list. */
   list_init(&t->donated_priorities);
 
@@ -550,12 +698,101 @@ alloc_frame(struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run(void)
 {
-  if (list_empty(&ready_list))
+  if (ready_cnt == 0)
     return idle_thread;
   else
   {
-    return list_entry(list_pop_front(&ready_list), struct thread, elem);
+    struct thread *t = list_entry(list_front(&ready_queues[ready_queue_highest()]),
+                                  struct thread, elem);
+    ready_queue_remove(t);
+    return t;
+  }
+}
+
+/* Appends T to the back of the run queue for its current
+   effective priority.  Interrupts must be off. */
+static void
+ready_queue_push(struct thread *t)
+{
+  int pri = thread_effective_priority(t);
+
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  t->ready_pri = pri;
+  list_push_back(&ready_queues[pri], &t->elem);
+  ready_bitmap |= (uint64_t)1 << pri;
+  ready_cnt++;
+}
+
+/* Removes T from the run queue it was last pushed onto.
+   Interrupts must be off. */
+static void
+ready_queue_remove(struct thread *t)
+{
+  int pri = t->ready_pri;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+  ASSERT(ready_cnt > 0);
+
+  list_remove(&t->elem);
+  if (list_empty(&ready_queues[pri]))
+    ready_bitmap &= ~((uint64_t)1 << pri);
+  ready_cnt--;
+}
+
+/* Returns the highest priority that has a nonempty run queue.
+   At least one run queue must be nonempty.  The bitmap is
+   examined one 32-bit half at a time so that each half is a
+   single `bsr' instruction. */
+static int
+ready_queue_highest(void)
+{
+  uint32_t hi = ready_bitmap >> 32;
+  uint32_t lo = ready_bitmap;
+
+  ASSERT(ready_bitmap != 0);
+
+  if (hi != 0)
+    return 63 - __builtin_clz(hi);
+  else
+    return 31 - __builtin_clz(lo);
+}
+
+/* Moves T to the run queue matching its current effective
+   priority, if T is ready and its priority has changed since it
+   was queued.  Must be called after every change to a thread's
+   priority or donations that might affect a ready thread. */
+void
+thread_requeue(struct thread *t)
+{
+  enum intr_level old_level;
+
+  ASSERT(is_thread(t));
+
+  old_level = intr_disable();
+  if (t->status == THREAD_READY && t != idle_thread
+      && t->ready_pri != thread_effective_priority(t))
+  {
+    ready_queue_remove(t);
+    ready_queue_push(t);
   }
+  intr_set_level(old_level);
+}
+
+/* Returns T's effective priority: the larger of its own priority
+   and the highest priority donated to it. */
+int
+thread_effective_priority(struct thread *t)
+{
+  int pri = t->priority;
+
+  if (!list_empty(&t->donated_priorities))
+  {
+    int inherited_pri = list_entry(list_front(&t->donated_priorities), struct thread, pri_elem)->priority;
+    if (pri < inherited_pri)
+      pri = inherited_pri;
+  }
+  return pri;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -640,16 +877,6 @@ allocate_tid(void)
   return tid;
 }
 
-/* A compare function for two threads (that sorts by sleep_duration).
-   To be passed into list_insert_ordered */
-bool thread_sleep_compare(const struct list_elem *left, const struct list_elem *right, void *aux UNUSED)
-{
-  struct thread *left_thread = list_entry(left, struct thread, timer_sleep_elem);
-  struct thread *right_thread = list_entry(right, struct thread, timer_sleep_elem);
-
-  return (left_thread->sleep_duration < right_thread->sleep_duration);
-}
-
 /* O functie de comparare a doua thread-uri care sorteaza dupa prioritate care insereaza un thread in list_insert_ordered */
 bool thread_priority_compare(const struct list_elem *left, const struct list_elem *right, void *aux UNUSED)
 {
@@ -5,6 +5,7 @@
 #include <list.h>
 #include <stdint.h>
 #include "synch.h"
+#include "threads/fixed-point.h"
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -25,6 +26,11 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread niceness, used only by the MLFQS scheduler. */
+#define NICE_MIN -20                    /* Nicest to other threads. */
+#define NICE_DEFAULT 0                  /* Default niceness. */
+#define NICE_MAX 20                     /* Least nice to other threads. */
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -89,6 +95,9 @@ struct thread
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
     int priority;                       /* Priority. */
+    int ready_pri;                      /* Run queue index while THREAD_READY. */
+    int nice;                           /* Niceness (MLFQS only). */
+    fixed_t recent_cpu;                 /* Recent CPU time received (MLFQS only). */
     struct list donated_priorities;     /* List of priorities that have been donated to this thread. */
 
     struct list priority_recipients;    /* List of threads that this thread has donated to. */
@@ -96,9 +105,8 @@ struct thread
     struct list_elem recp_elem;         /* A list element for keeping track of this thread in a priority_recipients list. */
 
     struct list_elem allelem;           /* List element for all threads list. */
-    struct semaphore sema;              /* Stores a semaphore local to the thread. */
-    int64_t sleep_duration;             /* Stores how long the thread sleeps (if applicable) */
-    struct list_elem timer_sleep_elem;  /* List element for the keeping track of sleeping threads in timer */
+    int64_t sleep_duration;             /* Tick at which a sleeping thread wakes up. */
+    struct list_elem timer_sleep_elem;  /* List element for the timer's timing wheel. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
@@ -110,9 +118,17 @@ struct thread
     int exit_status;                   /* Stores the status upon exit */
     struct list_elem child_elem;       /* Used to keep track of the element in the child list. */
     struct semaphore being_waited_on;  /* Used to put a parent thread to sleep when it needs to wait for a child. */
+    int64_t spawn_nsec;                /* When the parent started creating this process. */
+    bool forked;                       /* Created by fork() rather than exec()? */
     struct list file_descriptors;      /* List of file descriptors belonging to this therad. */
     int cur_fd;                        /* An integer available file descriptor. */
 #endif
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash *pages;                 /* Supplemental page table. */
+    void *user_esp;                     /* User stack pointer at last
+                                           kernel entry. */
+#endif
 
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
@@ -154,9 +170,6 @@ void thread_set_nice (int);
 int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
 
-/* Functie de comparare si inserare a thread-urilor bazata pe sleep_time*/
-bool thread_sleep_compare (const struct list_elem *left, const struct list_elem *right, void *aux UNUSED);
-
 /* Functie de comparare si inserare a thread-urilor bazata pe prioritate in ready_list */
 bool thread_priority_compare (const struct list_elem *left, const struct list_elem *right, void *aux UNUSED);
 
@@ -166,4 +179,7 @@ bool thread_priority_compare_donated (const struct list_elem *left, const struct
 /* Verifica daca thread-ul inserat are o prioritate mai mare decat thread-ul curent */
 void thread_priority_check (struct thread *t);
 
+int thread_effective_priority (struct thread *);
+void thread_requeue (struct thread *);
+
 #endif /* threads/thread.h */
@@ -4,7 +4,11 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "userprog/syscall.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -158,6 +162,23 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+#ifdef VM
+  /* Let the pager bring in the page, if it is one that the
+     process may access.  A fault in kernel context on a user
+     address comes from a system call touching user memory, for
+     which the stack pointer was saved at kernel entry. */
+  if (user)
+    thread_current ()->user_esp = f->esp;
+  if (not_present && is_user_vaddr (fault_addr) && page_in (fault_addr))
+    return;
+
+  /* A write to a present page may be the first write to a page
+     shared copy-on-write by fork(). */
+  if (!not_present && write && is_user_vaddr (fault_addr)
+      && page_make_writable (fault_addr))
+    return;
+#endif
+
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
      which fault_addr refers. */
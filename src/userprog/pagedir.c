@@ -1,8 +1,8 @@
 #include "userprog/pagedir.h"
 #include <stdbool.h>
 #include <stddef.h>
-#include <string.h>
 #include "threads/init.h"
+#include "threads/page-ops.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 
@@ -18,7 +18,7 @@ pagedir_create (void)
 {
   uint32_t *pd = palloc_get_page (0);
   if (pd != NULL)
-    memcpy (pd, init_page_dir, PGSIZE);
+    page_copy (pd, init_page_dir);
   return pd;
 }
 
@@ -37,16 +37,56 @@ pagedir_destroy (uint32_t *pd)
     if (*pde & PTE_P) 
       {
         uint32_t *pt = pde_get_pt (*pde);
+
+        /* With VM, the frames belong to vm/frame.c, and
+           page_exit() has already released them. */
+#ifndef VM
         uint32_t *pte;
-        
         for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
           if (*pte & PTE_P) 
             palloc_free_page (pte_get_page (*pte));
+#endif
         palloc_free_page (pt);
       }
   palloc_free_page (pd);
 }
 
+/* Maps a copy of each user page present in page directory SRC
+   at the same address in DST, with the same permissions, using
+   newly allocated pages from the user pool.  For fork() in
+   kernels without VM, which have nothing to share pages with.
+   Returns true if successful, false if memory runs out. */
+bool
+pagedir_copy (uint32_t *dst, uint32_t *src)
+{
+  uint32_t *pde;
+
+  for (pde = src; pde < src + pd_no (PHYS_BASE); pde++)
+    if (*pde & PTE_P) 
+      {
+        uint32_t *pt = pde_get_pt (*pde);
+        uint32_t *pte;
+
+        for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
+          if (*pte & PTE_P) 
+            {
+              void *upage = (void *) (((pde - src) << PDSHIFT)
+                                      | ((pte - pt) << PTSHIFT));
+              void *kpage = palloc_get_page (PAL_USER);
+              if (kpage == NULL)
+                return false;
+              page_copy (kpage, pte_get_page (*pte));
+              if (!pagedir_set_page (dst, upage, kpage,
+                                     (*pte & PTE_W) != 0))
+                {
+                  palloc_free_page (kpage);
+                  return false;
+                }
+            }
+      }
+  return true;
+}
+
 /* Returns the address of the page table entry for virtual
    address VADDR in page directory PD.
    If PD does not have a page table for VADDR, behavior depends
@@ -156,6 +196,30 @@ pagedir_clear_page (uint32_t *pd, void *upage)
     }
 }
 
+/* Makes user virtual page UPAGE in PD writable if WRITABLE is
+   true, read-only otherwise.  Other bits in the page table entry
+   are preserved.  UPAGE need not be mapped. */
+void
+pagedir_set_writable (uint32_t *pd, const void *upage, bool writable)
+{
+  uint32_t *pte;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  pte = lookup_page (pd, upage, false);
+  if (pte != NULL)
+    {
+      if (writable)
+        *pte |= PTE_W;
+      else
+        {
+          *pte &= ~(uint32_t) PTE_W;
+          invalidate_pagedir (pd);
+        }
+    }
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
    installed.
@@ -7,20 +7,47 @@
 #include <string.h>
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
+#include "devices/timer.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 static thread_func start_process NO_RETURN;
+static thread_func start_fork NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 
+/* Statistics. */
+static long long load_cnt;      /* Number of successful loads. */
+static int64_t load_nsec;       /* Total time spent in them. */
+static long long fork_cnt;      /* Number of successful forks. */
+static int64_t fork_nsec;       /* Total time spent in them. */
+static long long fork_cycle_cnt; /* Forked children waited for. */
+static int64_t fork_cycle_nsec; /* Total time from fork to reaping. */
+static long long exec_cycle_cnt; /* Executed children waited for. */
+static int64_t exec_cycle_nsec; /* Total time from exec to reaping. */
+
+/* Passed from process_fork() to start_fork() in the child. */
+struct fork_info
+  {
+    struct thread *parent;      /* Process being forked. */
+    struct intr_frame if_;      /* Parent's user registers. */
+    struct semaphore done;      /* Upped when the child is set up. */
+    bool success;               /* Did the child set up successfully? */
+    int64_t start;              /* When the parent called fork(). */
+  };
+
 /* A function to be passed to the thread_foreach() function to find a thread based on tid. */
 static void find_tid (struct thread *t, void * aux);
 /* A global variable - the thread that we are looking for in the thread list (NULL if not found). */
@@ -36,6 +63,7 @@ tid_t
 process_execute (const char *file_name)
 {
   char *fn_copy;
+  int64_t start = timer_nsec ();
   tid_t tid;
 
   /* Make a copy of FILE_NAME.
@@ -70,6 +98,8 @@ process_execute (const char *file_name)
     enum intr_level old_level = intr_disable ();
     thread_foreach(*find_tid, NULL);
     list_push_front(&thread_current()->child_process_list, &matching_thread->child_elem);
+    matching_thread->spawn_nsec = start;
+    matching_thread->forked = false;
     intr_set_level (old_level);
   }
   return tid;
@@ -82,6 +112,7 @@ start_process (void *file_name_)
 {
   char *file_name = file_name_;
   struct intr_frame if_;
+  int64_t start;
   bool success;
   
   /* Initialize interrupt frame and load executable. */
@@ -89,7 +120,15 @@ start_process (void *file_name_)
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
+  start = timer_nsec ();
   success = load (file_name, &if_.eip, &if_.esp);
+  if (success)
+    {
+      enum intr_level old_level = intr_disable ();
+      load_cnt++;
+      load_nsec += timer_nsec () - start;
+      intr_set_level (old_level);
+    }
 
   /* If load failed, quit. */
   palloc_free_page (file_name);
@@ -106,6 +145,96 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+/* Creates a child of the current process that is a copy of it,
+   with the same memory, open files, and registers, given the
+   current process's user registers in F, and waits for the child
+   to be set up.  With VM, the memory is not copied: parent and
+   child share each page read-only until one of them writes to it.
+   Returns the child's thread id, or TID_ERROR if the child cannot
+   be created.  In the child, the system call returns 0. */
+tid_t
+process_fork (const struct intr_frame *f)
+{
+  struct fork_info info;
+  int64_t start;
+  tid_t tid;
+
+  info.parent = thread_current ();
+  info.if_ = *f;
+  sema_init (&info.done, 0);
+  info.success = false;
+
+  start = info.start = timer_nsec ();
+  tid = thread_create (thread_name (), thread_get_priority (), start_fork,
+                       &info);
+  if (tid == TID_ERROR)
+    return TID_ERROR;
+  sema_down (&info.done);
+  if (!info.success)
+    return TID_ERROR;
+
+  enum intr_level old_level = intr_disable ();
+  fork_cnt++;
+  fork_nsec += timer_nsec () - start;
+  intr_set_level (old_level);
+  return tid;
+}
+
+/* A thread function that sets up a child of the process in the
+   fork_info passed as INFO_ and starts it running. */
+static void
+start_fork (void *info_)
+{
+  struct fork_info *info = info_;
+  struct thread *cur = thread_current ();
+  struct thread *parent = info->parent;
+  struct intr_frame if_ = info->if_;
+  enum intr_level old_level;
+  bool success = false;
+
+  cur->pagedir = pagedir_create ();
+  if (cur->pagedir == NULL)
+    goto done;
+  process_activate ();
+
+#ifdef VM
+  cur->pages = malloc (sizeof *cur->pages);
+  if (cur->pages == NULL)
+    goto done;
+  hash_init (cur->pages, page_hash, page_less, NULL);
+  if (!page_fork (parent))
+    goto done;
+  cur->user_esp = if_.esp;
+#else
+  if (!pagedir_copy (cur->pagedir, parent->pagedir))
+    goto done;
+#endif
+  if (!syscall_fork_files (parent))
+    goto done;
+
+  /* The parent is blocked until we up INFO->done, so its child
+     list cannot change under us. */
+  old_level = intr_disable ();
+  list_push_front (&parent->child_process_list, &cur->child_elem);
+  cur->spawn_nsec = info->start;
+  cur->forked = true;
+  intr_set_level (old_level);
+  success = true;
+
+ done:
+  /* INFO lives on the parent's stack, so it must not be touched
+     after upping INFO->done. */
+  info->success = success;
+  sema_up (&info->done);
+  if (!success)
+    thread_exit ();
+
+  /* Return 0 from fork() in the child. */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -124,6 +253,10 @@ process_wait (tid_t child_tid UNUSED)
   /* list element to iterate the list of child threads. */
   struct list_elem *temp;
 
+  enum intr_level old_level;
+  int64_t spawn_nsec, elapsed;
+  bool forked;
+
   /* If the list is empty, we have no children and do not need to wait. */
   if(list_empty(&thread_current()->child_process_list))
   {
@@ -151,10 +284,30 @@ process_wait (tid_t child_tid UNUSED)
      function for a second time does not require additional waiting. */
   list_remove(&child_thread->child_elem);
 
+  /* Once the child has exited, its thread may be freed at any time,
+     so take what the statistics need from it now. */
+  spawn_nsec = child_thread->spawn_nsec;
+  forked = child_thread->forked;
+
   /* Put the current thread to sleep by waiting on the child thread whose
      PID was passed in. */
   sema_down(&child_thread->being_waited_on);
 
+  /* Count the child's whole life, from the fork() or exec() that
+     created it until now, so that the two can be compared. */
+  elapsed = timer_nsec() - spawn_nsec;
+  old_level = intr_disable();
+  if (forked)
+  {
+    fork_cycle_cnt++;
+    fork_cycle_nsec += elapsed;
+  }
+  else
+  {
+    exec_cycle_cnt++;
+    exec_cycle_nsec += elapsed;
+  }
+  intr_set_level(old_level);
 
   /* After our kiddo is dead, we return its exit status. */
   return child_thread->exit_status;
@@ -167,6 +320,13 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd;
 
+#ifdef VM
+  /* Release the process's frames and swap slots.  This must
+     come before destroying the page directory, since another
+     thread evicting one of our pages uses it. */
+  page_exit ();
+#endif
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
@@ -201,6 +361,25 @@ process_activate (void)
      interrupts. */
   tss_update ();
 }
+
+/* Prints process loading and forking statistics.  The fork time
+   covers only the parent's side of fork(); the cycle times cover
+   creating a child, running it until it exits, and waiting for
+   it. */
+void
+process_print_stats (void)
+{
+  printf ("Process: %lld loads, %"PRId64" us average load time\n",
+          load_cnt, load_cnt > 0 ? load_nsec / load_cnt / 1000 : 0);
+  printf ("Process: %lld forks, %"PRId64" us average fork time\n",
+          fork_cnt, fork_cnt > 0 ? fork_nsec / fork_cnt / 1000 : 0);
+  printf ("Process: %lld fork-exit-wait cycles, %"PRId64" us average\n",
+          fork_cycle_cnt,
+          fork_cycle_cnt > 0 ? fork_cycle_nsec / fork_cycle_cnt / 1000 : 0);
+  printf ("Process: %lld exec-exit-wait cycles, %"PRId64" us average\n",
+          exec_cycle_cnt,
+          exec_cycle_cnt > 0 ? exec_cycle_nsec / exec_cycle_cnt / 1000 : 0);
+}
 
 /* We load ELF binaries.  The following definitions are taken
    from the ELF specification, [ELF1], more-or-less verbatim.  */
@@ -291,6 +470,14 @@ load (const char *file_name, void (**eip) (void), void **esp)
     goto done;
   process_activate ();
 
+#ifdef VM
+  /* Create the supplemental page table. */
+  t->pages = malloc (sizeof *t->pages);
+  if (t->pages == NULL)
+    goto done;
+  hash_init (t->pages, page_hash, page_less, NULL);
+#endif
+
   /* For use in the string tokenizer below... */
   char *token, *save_ptr;
   /* List of all command line arguments. 25 is a somewhat arbitrary limit,
@@ -413,7 +600,9 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -472,6 +661,11 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With VM, nothing is read here.  Each page only gets an entry
+   in the supplemental page table that says where its data comes
+   from, and page_in() reads it, or zeroes it, on first access.
+   Pages that are never touched are never read or given a frame.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -482,7 +676,9 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+#ifndef VM
   file_seek (file, ofs);
+#endif
   while (read_bytes > 0 || zero_bytes > 0)
     {
       /* Calculate how to fill this page.
@@ -491,6 +687,20 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
+#ifdef VM
+      /* Record where the page comes from.  A page with nothing
+         to read is a demand-zero page. */
+      struct page *p = page_allocate (upage, !writable);
+      if (p == NULL)
+        return false;
+      if (page_read_bytes > 0)
+        {
+          p->file = file;
+          p->file_offset = ofs;
+          p->file_bytes = page_read_bytes;
+        }
+      ofs += page_read_bytes;
+#else
       /* Get a page of memory. */
       uint8_t *kpage = palloc_get_page (PAL_USER);
       if (kpage == NULL)
@@ -510,6 +720,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
           palloc_free_page (kpage);
           return false;
         }
+#endif
 
       /* Advance. */
       read_bytes -= page_read_bytes;
@@ -524,66 +735,77 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 static bool
 setup_stack (void **esp, int argc, char *argv[])
 {
-  uint8_t *kpage;
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
   bool success = false;
 
-  kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+#ifdef VM
+  /* Map a demand-zero page and bring it in now, since we are
+     about to write the arguments to it. */
+  success = page_allocate (upage, false) != NULL && page_lock (upage, true);
+#else
+  uint8_t *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
   if (kpage != NULL)
     {
-      success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
-      if (success)
-      {
-        /* Stack initialization code insipired by the work of pindexis
-        (the full GitHub link of which is available in Design2.txt).
-        Mainly used to determine correct pointer types. */
-
-        /* Offset PHYS_BASE as instructed. */
-        *esp = PHYS_BASE - 12;
-        /* A list of addresses to the values that are intially added to the stack.  */
-        uint32_t * arg_value_pointers[argc];
-
-        /* First add all of the command line arguments in descending order, including
-           the program name. */
-        for(int i = argc-1; i >= 0; i--)
-        {
-          /* Allocate enough space for the entire string (plus and extra byte for
-             '/0'). Copy the string to the stack, and add its reference to the array
-              of pointers. */
-          *esp = *esp - sizeof(char)*(strlen(argv[i])+1);
-          memcpy(*esp, argv[i], sizeof(char)*(strlen(argv[i])+1));
-          arg_value_pointers[i] = (uint32_t *)*esp;
-        }
-        /* Allocate space for & add the null sentinel. */
-        *esp = *esp - 4;
-        (*(int *)(*esp)) = 0;
-
-        /* Push onto the stack each char* in arg_value_pointers[] (each of which
-           references an argument that was previously added to the stack). */
-        *esp = *esp - 4;
-        for(int i = argc-1; i >= 0; i--)
-        {
-          (*(uint32_t **)(*esp)) = arg_value_pointers[i];
-          *esp = *esp - 4;
-        }
+      success = install_page (upage, kpage, true);
+      if (!success)
+        palloc_free_page (kpage);
+    }
+#endif
+  if (success)
+  {
+    /* Stack initialization code insipired by the work of pindexis
+    (the full GitHub link of which is available in Design2.txt).
+    Mainly used to determine correct pointer types. */
+
+    /* Offset PHYS_BASE as instructed. */
+    *esp = PHYS_BASE - 12;
+    /* A list of addresses to the values that are intially added to the stack.  */
+    uint32_t * arg_value_pointers[argc];
+
+    /* First add all of the command line arguments in descending order, including
+       the program name. */
+    for(int i = argc-1; i >= 0; i--)
+    {
+      /* Allocate enough space for the entire string (plus and extra byte for
+         '/0'). Copy the string to the stack, and add its reference to the array
+          of pointers. */
+      *esp = *esp - sizeof(char)*(strlen(argv[i])+1);
+      memcpy(*esp, argv[i], sizeof(char)*(strlen(argv[i])+1));
+      arg_value_pointers[i] = (uint32_t *)*esp;
+    }
+    /* Allocate space for & add the null sentinel. */
+    *esp = *esp - 4;
+    (*(int *)(*esp)) = 0;
+
+    /* Push onto the stack each char* in arg_value_pointers[] (each of which
+       references an argument that was previously added to the stack). */
+    *esp = *esp - 4;
+    for(int i = argc-1; i >= 0; i--)
+    {
+      (*(uint32_t **)(*esp)) = arg_value_pointers[i];
+      *esp = *esp - 4;
+    }
 
-        /* Push onto the stack a pointer to the pointer of the address of the
-           first argument in the list of arguments. */
-        (*(uintptr_t **)(*esp)) = *esp + 4;
+    /* Push onto the stack a pointer to the pointer of the address of the
+       first argument in the list of arguments. */
+    (*(uintptr_t **)(*esp)) = *esp + 4;
 
-        /* Push onto the stack the number of program arguments. */
-        *esp = *esp - 4;
-        *(int *)(*esp) = argc;
+    /* Push onto the stack the number of program arguments. */
+    *esp = *esp - 4;
+    *(int *)(*esp) = argc;
 
-        /* Push onto the stack a fake return address, which completes stack initialization. */
-        *esp = *esp - 4;
-        (*(int *)(*esp)) = 0;
-      }
-      else
-        palloc_free_page (kpage);
-    }
+    /* Push onto the stack a fake return address, which completes stack initialization. */
+    *esp = *esp - 4;
+    (*(int *)(*esp)) = 0;
+
+#ifdef VM
+    page_unlock (upage);
+#endif
+  }
   return success;
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -603,6 +825,7 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
 
 
 
@@ -11,6 +11,7 @@
 #include "filesys/file.h"
 #include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
@@ -37,6 +38,9 @@ static int sys_munmap(int mapping);
 
 static void syscall_handler(struct intr_frame *);
 static void copy_in(void *, const void *, size_t);
+static char *copy_string_from_user(const char *ustr);
+static int read_to_user(int fd, void *ubuf, unsigned length);
+static int write_from_user(int fd, const void *ubuf, unsigned length);
 
 /* Get up to three arguments from a programs stack (they directly follow the system
 call argument). */
@@ -54,11 +58,16 @@ struct thread_file
 /* Lock is in charge of ensuring that only one process can access the file system at one time. */
 struct lock lock_filesys;
 
+/* Cache that the thread_file structs are allocated from. */
+static struct kmem_cache *thread_file_cache;
+
 void syscall_init(void)
 {
   /* Initialize the lock for the file system. */
   lock_init(&lock_filesys);
 
+  thread_file_cache = kmem_cache_create("thread_file", sizeof(struct thread_file), NULL);
+
   intr_register_int(0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
@@ -69,11 +78,17 @@ syscall_handler(struct intr_frame *f UNUSED)
   /* First ensure that the system call argument is a valid address. If not, exit immediately. */
   check_valid_addr((const void *)f->esp);
 
+#ifdef VM
+  /* Save the user stack pointer, for telling stack accesses from bad
+     ones if we fault on a user address. */
+  thread_current()->user_esp = f->esp;
+#endif
+
   /* Holds the stack arguments that directly follow the system call. */
   int args[3];
 
-  /* Stores the physical page pointer. */
-  void *phys_page_ptr;
+  /* Kernel copy of a string argument. */
+  char *kstr;
 
   /* Get the value of the system call (based on enum) and call corresponding syscall function. */
   switch (*(int *)f->esp)
@@ -95,16 +110,12 @@ syscall_handler(struct intr_frame *f UNUSED)
     /* The first argument of exec is the entire command line text for executing the program */
     get_stack_arguments(f, &args[0], 1);
 
-    /* Ensures that converted address is valid. */
-    phys_page_ptr = (void *)pagedir_get_page(thread_current()->pagedir, (const void *)args[0]);
-    if (phys_page_ptr == NULL)
-    {
-      exit(-1);
-    }
-    args[0] = (int)phys_page_ptr;
+    /* Copy the command line into kernel memory. */
+    kstr = copy_string_from_user((const char *)args[0]);
 
     /* Return the result of the exec() function in the eax register. */
-    f->eax = exec((const char *)args[0]);
+    f->eax = exec(kstr);
+    palloc_free_page(kstr);
     break;
 
   case SYS_WAIT:
@@ -122,48 +133,36 @@ syscall_handler(struct intr_frame *f UNUSED)
     get_stack_arguments(f, &args[0], 2);
     check_buffer((void *)args[0], args[1]);
 
-    /* Ensures that converted address is valid. */
-    phys_page_ptr = pagedir_get_page(thread_current()->pagedir, (const void *)args[0]);
-    if (phys_page_ptr == NULL)
-    {
-      exit(-1);
-    }
-    args[0] = (int)phys_page_ptr;
+    /* Copy the file name into kernel memory. */
+    kstr = copy_string_from_user((const char *)args[0]);
 
     /* Return the result of the create() function in the eax register. */
-    f->eax = create((const char *)args[0], (unsigned)args[1]);
+    f->eax = create(kstr, (unsigned)args[1]);
+    palloc_free_page(kstr);
     break;
 
   case SYS_REMOVE:
     /* The first argument of remove is the file name to be removed. */
     get_stack_arguments(f, &args[0], 1);
 
-    /* Ensures that converted address is valid. */
-    phys_page_ptr = pagedir_get_page(thread_current()->pagedir, (const void *)args[0]);
-    if (phys_page_ptr == NULL)
-    {
-      exit(-1);
-    }
-    args[0] = (int)phys_page_ptr;
+    /* Copy the file name into kernel memory. */
+    kstr = copy_string_from_user((const char *)args[0]);
 
     /* Return the result of the remove() function in the eax register. */
-    f->eax = remove((const char *)args[0]);
+    f->eax = remove(kstr);
+    palloc_free_page(kstr);
     break;
 
   case SYS_OPEN:
     /* The first argument is the name of the file to be opened. */
     get_stack_arguments(f, &args[0], 1);
 
-    /* Ensures that converted address is valid. */
-    phys_page_ptr = pagedir_get_page(thread_current()->pagedir, (const void *)args[0]);
-    if (phys_page_ptr == NULL)
-    {
-      exit(-1);
-    }
-    args[0] = (int)phys_page_ptr;
+    /* Copy the file name into kernel memory. */
+    kstr = copy_string_from_user((const char *)args[0]);
 
-    /* Return the result of the remove() function in the eax register. */
-    f->eax = open((const char *)args[0]);
+    /* Return the result of the open() function in the eax register. */
+    f->eax = open(kstr);
+    palloc_free_page(kstr);
 
     break;
 
@@ -183,16 +182,9 @@ syscall_handler(struct intr_frame *f UNUSED)
     /* Make sure the whole buffer is valid. */
     check_buffer((void *)args[1], args[2]);
 
-    /* Ensures that converted address is valid. */
-    phys_page_ptr = pagedir_get_page(thread_current()->pagedir, (const void *)args[1]);
-    if (phys_page_ptr == NULL)
-    {
-      exit(-1);
-    }
-    args[1] = (int)phys_page_ptr;
-
-    /* Return the result of the read() function in the eax register. */
-    f->eax = read(args[0], (void *)args[1], (unsigned)args[2]);
+    /* Return the result of the read() function, done one page of the
+       buffer at a time, in the eax register. */
+    f->eax = read_to_user(args[0], (void *)args[1], (unsigned)args[2]);
     break;
 
   case SYS_WRITE:
@@ -203,16 +195,9 @@ syscall_handler(struct intr_frame *f UNUSED)
     /* Make sure the whole buffer is valid. */
     check_buffer((void *)args[1], args[2]);
 
-    /* Ensures that converted address is valid. */
-    phys_page_ptr = pagedir_get_page(thread_current()->pagedir, (const void *)args[1]);
-    if (phys_page_ptr == NULL)
-    {
-      exit(-1);
-    }
-    args[1] = (int)phys_page_ptr;
-
-    /* Return the result of the write() function in the eax register. */
-    f->eax = write(args[0], (const void *)args[1], (unsigned)args[2]);
+    /* Return the result of the write() function, done one page of the
+       buffer at a time, in the eax register. */
+    f->eax = write_from_user(args[0], (const void *)args[1], (unsigned)args[2]);
     break;
 
   case SYS_SEEK:
@@ -240,6 +225,20 @@ syscall_handler(struct intr_frame *f UNUSED)
     close(args[0]);
     break;
 
+  case SYS_FSYNC:
+    /* fsync has exactly one stack argument, representing the fd of the file. */
+    get_stack_arguments(f, &args[0], 1);
+
+    /* We write the file's dirty data back to disk. */
+    f->eax = fsync(args[0]);
+    break;
+
+  case SYS_FORK:
+    /* fork takes no arguments.  The parent gets the child's pid, and the
+       child, which starts from a copy of this frame, gets 0. */
+    f->eax = process_fork(f);
+    break;
+
   default:
     /* If an invalid system call was sent, terminate the program. */
     exit(-1);
@@ -247,6 +246,161 @@ syscall_handler(struct intr_frame *f UNUSED)
   }
 }
 
+/* Returns the kernel virtual address that user address UADDR is
+   mapped to, or a null pointer if it is not mapped.  With VM, a
+   page that the process has not touched yet, such as one of its
+   lazily loaded data pages, is paged in first, and the page is
+   locked into memory so that it can't be evicted while the
+   kernel uses it.  Only the page containing UADDR is translated,
+   so callers must not access more than the rest of that page
+   through the result.  If WRITE is true, the kernel will write to
+   the page, so it must be writable and, if it is shared
+   copy-on-write after fork(), gets a copy of its own first.
+   A successful call must be followed by unlock_user_page(). */
+static void *
+lock_user_page(const void *uaddr, bool write)
+{
+#ifdef VM
+  if (!page_lock(uaddr, write))
+    return NULL;
+  return pagedir_get_page(thread_current()->pagedir, uaddr);
+#else
+  (void)write;
+  return pagedir_get_page(thread_current()->pagedir, uaddr);
+#endif
+}
+
+/* Unlocks the user page containing UADDR, which was locked with
+   lock_user_page(). */
+static void
+unlock_user_page(const void *uaddr)
+{
+#ifdef VM
+  page_unlock(uaddr);
+#else
+  (void)uaddr;
+#endif
+}
+
+/* Copies the null-terminated string at user address USTR into a
+   new kernel page and returns it.  The caller must free it with
+   palloc_free_page().  Like a buffer, a string may cross into a
+   page that is not contiguous in kernel memory, or not present
+   yet, so each page of it is locked and copied separately.  The
+   copy is truncated to fit in a page, as process_execute() would
+   truncate a command line.  Terminates the process if the string
+   is not in valid user memory. */
+static char *
+copy_string_from_user(const char *ustr)
+{
+  char *kstr = palloc_get_page(0);
+  size_t length = 0;
+
+  if (kstr == NULL)
+  {
+    exit(-1);
+  }
+
+  for (;;)
+  {
+    /* Copy at most up to the end of the page that USTR is in. */
+    size_t page_left = PGSIZE - pg_ofs(ustr);
+    const char *kpage = NULL;
+    size_t i;
+
+    if (is_user_vaddr(ustr))
+      kpage = lock_user_page(ustr, false);
+    if (kpage == NULL)
+    {
+      palloc_free_page(kstr);
+      exit(-1);
+    }
+    for (i = 0; i < page_left; i++)
+    {
+      kstr[length] = length < PGSIZE - 1 ? kpage[i] : '\0';
+      if (kstr[length++] == '\0')
+      {
+        unlock_user_page(ustr);
+        return kstr;
+      }
+    }
+    unlock_user_page(ustr);
+    ustr += page_left;
+  }
+}
+
+/* Reads LENGTH bytes from the open file FD into user buffer UBUF.
+   A buffer may span several pages that are not contiguous in
+   kernel memory, or not present at all yet, so each page is
+   locked and read into separately.  Returns the number of bytes
+   read, or -1 if nothing could be read. */
+static int
+read_to_user(int fd, void *ubuf_, unsigned length)
+{
+  uint8_t *ubuf = ubuf_;
+  int bytes_read = 0;
+
+  while (length > 0)
+  {
+    /* Read at most up to the end of the page that UBUF is in. */
+    unsigned page_left = PGSIZE - pg_ofs(ubuf);
+    unsigned chunk_size = length < page_left ? length : page_left;
+    void *kbuf = lock_user_page(ubuf, true);
+    int retval;
+
+    if (kbuf == NULL)
+    {
+      exit(-1);
+    }
+    retval = read(fd, kbuf, chunk_size);
+    unlock_user_page(ubuf);
+
+    if (retval < 0)
+      return bytes_read > 0 ? bytes_read : -1;
+    bytes_read += retval;
+
+    /* A short read means end of file, so we're done. */
+    if ((unsigned)retval != chunk_size)
+      break;
+    ubuf += retval;
+    length -= retval;
+  }
+  return bytes_read;
+}
+
+/* Writes LENGTH bytes from user buffer UBUF to the open file FD,
+   locking and writing one page of the buffer at a time, like
+   read_to_user().  Returns the number of bytes written. */
+static int
+write_from_user(int fd, const void *ubuf_, unsigned length)
+{
+  const uint8_t *ubuf = ubuf_;
+  int bytes_written = 0;
+
+  while (length > 0)
+  {
+    /* Write at most up to the end of the page that UBUF is in. */
+    unsigned page_left = PGSIZE - pg_ofs(ubuf);
+    unsigned chunk_size = length < page_left ? length : page_left;
+    const void *kbuf = lock_user_page(ubuf, false);
+    int retval;
+
+    if (kbuf == NULL)
+    {
+      exit(-1);
+    }
+    retval = write(fd, kbuf, chunk_size);
+    unlock_user_page(ubuf);
+
+    bytes_written += retval;
+    if ((unsigned)retval != chunk_size)
+      break;
+    ubuf += retval;
+    length -= retval;
+  }
+  return bytes_written;
+}
+
 /* Copies SIZE bytes from user address USRC to kernel address
    DST.
    Call thread_exit() if any of the user accesses are invalid. */
@@ -749,7 +903,13 @@ int open(const char *file)
 
   /* Create a struct to hold the file/fd, for use in a list in the current process.
      Increment the fd for future files. Release our lock and return the fd as an int. */
-  struct thread_file *new_file = malloc(sizeof(struct thread_file));
+  struct thread_file *new_file = kmem_cache_alloc(thread_file_cache);
+  if (new_file == NULL)
+  {
+    file_close(f);
+    lock_release(&lock_filesys);
+    return -1;
+  }
   new_file->file_addr = f;
   int fd = thread_current()->cur_fd;
   thread_current()->cur_fd++;
@@ -930,6 +1090,7 @@ void close(int fd)
     {
       file_close(t->file_addr);
       list_remove(&t->file_elem);
+      kmem_cache_free(thread_file_cache, t);
       lock_release(&lock_filesys);
       return;
     }
@@ -940,6 +1101,75 @@ void close(int fd)
   return;
 }
 
+/* Writes any data written to open file fd that is still held in the buffer
+   cache back to disk, along with the free map.  Returns true if successful,
+   false if fd is not open.  The cache does not track which blocks belong to
+   which file, so this flushes every dirty block, fd's among them. */
+bool fsync(int fd)
+{
+  /* list element to iterate the list of file descriptors. */
+  struct list_elem *temp;
+
+  lock_acquire(&lock_filesys);
+
+  /* Look to see if the given fd is in our list of file_descriptors. If so, then we
+     flush the cache. */
+  for (temp = list_begin(&thread_current()->file_descriptors);
+       temp != list_end(&thread_current()->file_descriptors); temp = list_next(temp))
+  {
+    struct thread_file *t = list_entry(temp, struct thread_file, file_elem);
+    if (t->file_descriptor == fd)
+    {
+      filesys_sync();
+      lock_release(&lock_filesys);
+      return true;
+    }
+  }
+
+  lock_release(&lock_filesys);
+
+  return false;
+}
+
+/* Gives the current process, just created by fork(), its own copy of each
+   of PARENT's open files, under the same file descriptor and at the same
+   position.  PARENT must be blocked until this returns.  Returns true if
+   successful, false if memory runs out. */
+bool syscall_fork_files(struct thread *parent)
+{
+  struct thread *cur = thread_current();
+  struct list_elem *temp;
+  bool success = true;
+
+  lock_acquire(&lock_filesys);
+
+  for (temp = list_begin(&parent->file_descriptors);
+       temp != list_end(&parent->file_descriptors); temp = list_next(temp))
+  {
+    struct thread_file *t = list_entry(temp, struct thread_file, file_elem);
+    struct thread_file *copy = kmem_cache_alloc(thread_file_cache);
+    if (copy == NULL)
+    {
+      success = false;
+      break;
+    }
+    copy->file_addr = file_reopen(t->file_addr);
+    if (copy->file_addr == NULL)
+    {
+      kmem_cache_free(thread_file_cache, copy);
+      success = false;
+      break;
+    }
+    file_seek(copy->file_addr, file_tell(t->file_addr));
+    copy->file_descriptor = t->file_descriptor;
+    list_push_back(&cur->file_descriptors, &copy->file_elem);
+  }
+  cur->cur_fd = parent->cur_fd;
+
+  lock_release(&lock_filesys);
+  return success;
+}
+
 /* Check to make sure that the given pointer is in user space,
    and is not null. We must exit the program and free its resources should
    any of these conditions be violated. */
@@ -22,6 +22,10 @@ int write (int fd, const void *buffer, unsigned length);
 void seek (int fd, unsigned position);
 unsigned tell (int fd);
 void close (int fd);
+bool fsync (int fd);
+
+struct thread;
+bool syscall_fork_files (struct thread *parent);
 
 /* Ensures that a given pointer is in valid user memory. */
 void check_valid_addr (const void *ptr_to_check);
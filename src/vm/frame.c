@@ -1,11 +1,15 @@
 #include "vm/frame.h"
 #include <stdio.h>
 #include "vm/page.h"
+#include "vm/swap.h"
 #include "devices/timer.h"
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/page-ops.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 static struct frame *frames;
@@ -14,6 +18,45 @@ static size_t frame_cnt;
 static struct lock scan_lock;
 static size_t hand;
 
+/* Frames holding read-only file data, keyed on inode, offset,
+   and number of bytes read, so that processes running the same
+   executable can map the same frames for its code instead of
+   each reading its own copy.  The byte count is part of the key
+   because a page that reads fewer bytes from the same offset,
+   such as the last page of a segment, is zeroed past them.
+
+   A frame's lock may be held while acquiring share_lock, but not
+   the reverse: with share_lock held, frame locks are only tried,
+   with lock_try_acquire(). */
+static struct hash shared_frames;
+static struct lock share_lock;
+
+/* Page cleaner.  When free frames run low, a low-priority thread
+   writes back the dirty pages in the frames just ahead of the
+   clock hand, which are the next candidates for eviction, so that
+   evicting them can just drop them instead of making a faulting
+   process wait for the write.  clean_wanted is true when the
+   cleaner has already been woken and has not yet started its
+   pass. */
+static struct semaphore clean_sema;
+static bool clean_wanted;
+static size_t clean_watermark;  /* Wake the cleaner at or below this
+                                   many free frames. */
+
+/* Number of frames ahead of the clock hand that the cleaner
+   examines in each pass. */
+#define CLEAN_AHEAD 32
+
+static thread_func clean_thread NO_RETURN;
+
+/* Statistics. */
+static size_t used_cnt;         /* Frames mapped by at least one page. */
+static size_t peak_used_cnt;    /* Maximum of used_cnt. */
+static long long share_cnt;     /* Pages mapped to an existing frame. */
+
+static hash_hash_func share_hash;
+static hash_less_func share_less;
+
 /* Initialize the frame manager. */
 void
 frame_init (void) 
@@ -21,6 +64,9 @@ frame_init (void)
   void *base;
 
   lock_init (&scan_lock);
+  lock_init (&share_lock);
+  sema_init (&clean_sema, 0);
+  hash_init (&shared_frames, share_hash, share_less, NULL);
   
   frames = malloc (sizeof *frames * init_ram_pages);
   if (frames == NULL)
@@ -31,8 +77,205 @@ frame_init (void)
       struct frame *f = &frames[frame_cnt++];
       lock_init (&f->lock);
       f->base = base;
-      f->page = NULL;
+      list_init (&f->pages);
+      f->ref_cnt = 0;
+      f->inode = NULL;
+      f->offset = 0;
+    }
+  clean_watermark = frame_cnt / 16;
+}
+
+/* Starts the page cleaner thread.  Called once swap is set up. */
+void
+frame_start_cleaning (void)
+{
+  thread_create ("pclean", PRI_MIN, clean_thread, NULL);
+}
+
+/* Wakes the page cleaner if free frames are running low. */
+static void
+wake_cleaner (void)
+{
+  enum intr_level old_level;
+  bool wake = false;
+
+  old_level = intr_disable ();
+  if (frame_cnt - used_cnt <= clean_watermark && !clean_wanted)
+    wake = clean_wanted = true;
+  intr_set_level (old_level);
+
+  if (wake)
+    sema_up (&clean_sema);
+}
+
+/* Page cleaner thread.  Each time it is woken, writes back the
+   dirty pages in the CLEAN_AHEAD frames starting at the clock
+   hand.  Frames that are busy, or that several pages map, are
+   left to eviction. */
+static void
+clean_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      enum intr_level old_level;
+      size_t start, i;
+
+      sema_down (&clean_sema);
+      old_level = intr_disable ();
+      clean_wanted = false;
+      intr_set_level (old_level);
+
+      start = hand;
+      for (i = 0; i < CLEAN_AHEAD && i < frame_cnt; i++)
+        {
+          struct frame *f = &frames[(start + i) % frame_cnt];
+
+          if (!lock_try_acquire (&f->lock))
+            continue;
+          if (f->ref_cnt == 1)
+            page_clean (list_entry (list_front (&f->pages),
+                                    struct page, frame_elem));
+          lock_release (&f->lock);
+        }
+    }
+}
+
+/* Adds DELTA to the number of frames in use. */
+static void
+count_used (int delta)
+{
+  enum intr_level old_level = intr_disable ();
+  used_cnt += delta;
+  if (used_cnt > peak_used_cnt)
+    peak_used_cnt = used_cnt;
+  intr_set_level (old_level);
+}
+
+/* Adds PAGE to the pages mapping F, which must be locked. */
+void
+frame_attach (struct frame *f, struct page *page)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  if (f->ref_cnt++ == 0)
+    count_used (1);
+  list_push_back (&f->pages, &page->frame_elem);
+}
+
+/* Removes F, which must be locked, from the shared frame table,
+   if it is there. */
+static void
+unshare (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  if (f->inode != NULL)
+    {
+      lock_acquire (&share_lock);
+      hash_delete (&shared_frames, &f->share_elem);
+      f->inode = NULL;
+      lock_release (&share_lock);
+    }
+}
+
+/* Returns true if any page mapping F, which must be locked, has
+   been accessed recently, and clears all of their accessed
+   bits. */
+static bool
+frame_accessed_recently (struct frame *f)
+{
+  struct list_elem *e;
+  bool accessed = false;
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    if (page_accessed_recently (list_entry (e, struct page, frame_elem)))
+      accessed = true;
+  return accessed;
+}
+
+/* Evicts every page mapping each of the CNT frames in VICTIMS,
+   which must be locked, so that the frames can be reused.  Each
+   page is marked not present in its process's page table before
+   its frame is given up.  The pages that go to swap are written
+   together, in one transfer if possible.
+   Returns true if VICTIMS[0] was emptied, false on failure.  The
+   other frames may or may not have been emptied. */
+static bool
+evict (struct frame **victims, size_t cnt)
+{
+  struct swap_cluster cluster;
+  size_t i;
+
+  cluster.cnt = 0;
+  for (i = 0; i < cnt; i++)
+    {
+      struct frame *f = victims[i];
+      struct list_elem *e;
+
+      /* Stop other processes from mapping F while we work. */
+      unshare (f);
+
+      for (e = list_begin (&f->pages); e != list_end (&f->pages);
+           e = list_next (e))
+        page_out (list_entry (e, struct page, frame_elem), &cluster);
+    }
+  page_out_cluster (&cluster);
+
+  /* Drop the pages that are now out of memory.  A page that could
+     not be evicted keeps its frame. */
+  for (i = 0; i < cnt; i++)
+    {
+      struct frame *f = victims[i];
+      struct list_elem *e = list_begin (&f->pages);
+
+      while (e != list_end (&f->pages))
+        {
+          struct page *p = list_entry (e, struct page, frame_elem);
+          if (p->frame == NULL)
+            {
+              e = list_remove (e);
+              if (--f->ref_cnt == 0)
+                count_used (-1);
+            }
+          else
+            e = list_next (e);
+        }
     }
+  return victims[0]->ref_cnt == 0;
+}
+
+/* Advances the clock hand to find up to CNT more frames that can
+   be evicted along with one already chosen, so that their pages
+   can be written to swap together.  Stores the frames, locked, in
+   VICTIMS and returns the number found.  Stops early at a free
+   frame, since then memory is not short.
+   scan_lock must be held. */
+static size_t
+find_more_victims (struct frame **victims, size_t cnt)
+{
+  size_t found = 0;
+  size_t i;
+
+  for (i = 0; i < cnt * 2 && found < cnt; i++)
+    {
+      struct frame *f = &frames[hand];
+      if (++hand >= frame_cnt)
+        hand = 0;
+
+      if (!lock_try_acquire (&f->lock))
+        continue;
+      if (f->ref_cnt == 0)
+        {
+          lock_release (&f->lock);
+          break;
+        }
+      if (frame_accessed_recently (f))
+        lock_release (&f->lock);
+      else
+        victims[found++] = f;
+    }
+  return found;
 }
 
 /* Tries to allocate and lock a frame for PAGE.
@@ -40,6 +283,8 @@ frame_init (void)
 static struct frame *
 try_frame_alloc_and_lock (struct page *page) 
 {
+  struct frame *victims[SWAP_CLUSTER_PAGES];
+  size_t victim_cnt;
   size_t i;
 
   lock_acquire (&scan_lock);
@@ -50,9 +295,9 @@ try_frame_alloc_and_lock (struct page *page)
       struct frame *f = &frames[i];
       if (!lock_try_acquire (&f->lock))
         continue;
-      if (f->page == NULL) 
+      if (f->ref_cnt == 0) 
         {
-          f->page = page;
+          frame_attach (f, page);
           lock_release (&scan_lock);
           return f;
         } 
@@ -70,29 +315,38 @@ try_frame_alloc_and_lock (struct page *page)
       if (!lock_try_acquire (&f->lock))
         continue;
 
-      if (f->page == NULL) 
+      if (f->ref_cnt == 0) 
         {
-          f->page = page;
+          frame_attach (f, page);
           lock_release (&scan_lock);
           return f;
         } 
 
-      if (page_accessed_recently (f->page)) 
+      if (frame_accessed_recently (f)) 
         {
           lock_release (&f->lock);
           continue;
         }
           
+      /* Evict this frame, along with a few more that will have to
+         be evicted soon anyway, so that the pages going to swap
+         can be written together.  The extra frames are left free
+         for the allocations that follow. */
+      victims[0] = f;
+      victim_cnt = 1 + find_more_victims (victims + 1,
+                                          SWAP_CLUSTER_PAGES - 1);
       lock_release (&scan_lock);
-      
-      /* Evict this frame. */
-      if (!page_out (f->page))
+
+      if (!evict (victims, victim_cnt))
         {
-          lock_release (&f->lock);
+          for (i = 0; i < victim_cnt; i++)
+            lock_release (&victims[i]->lock);
           return NULL;
         }
+      for (i = 1; i < victim_cnt; i++)
+        lock_release (&victims[i]->lock);
 
-      f->page = page;
+      frame_attach (f, page);
       return f;
     }
 
@@ -114,6 +368,7 @@ frame_alloc_and_lock (struct page *page)
       if (f != NULL) 
         {
           ASSERT (lock_held_by_current_thread (&f->lock));
+          wake_cleaner ();
           return f; 
         }
       timer_msleep (1000);
@@ -122,6 +377,91 @@ frame_alloc_and_lock (struct page *page)
   return NULL;
 }
 
+/* Looks for a frame that already holds BYTES bytes of read-only
+   file data at OFFSET in INODE, followed by zeros.  If there is
+   one and it can be locked without waiting, adds PAGE to the
+   pages mapping it and returns it, locked.  Otherwise, returns a
+   null pointer, and the caller should read the data into a frame
+   of its own. */
+struct frame *
+frame_share_and_lock (struct page *page, struct inode *inode,
+                      off_t offset, off_t bytes)
+{
+  struct frame key;
+  struct hash_elem *e;
+  struct frame *f = NULL;
+
+  key.inode = inode;
+  key.offset = offset;
+  key.bytes = bytes;
+
+  lock_acquire (&share_lock);
+  e = hash_find (&shared_frames, &key.share_elem);
+  if (e != NULL)
+    {
+      f = hash_entry (e, struct frame, share_elem);
+      if (lock_try_acquire (&f->lock))
+        {
+          frame_attach (f, page);
+          share_cnt++;
+        }
+      else
+        f = NULL;
+    }
+  lock_release (&share_lock);
+
+  return f;
+}
+
+/* Offers F, which must be locked and must hold BYTES bytes of
+   the read-only file data at OFFSET in INODE followed by zeros,
+   to frame_share_and_lock().  Does nothing if another frame
+   already holds the same data. */
+void
+frame_publish (struct frame *f, struct inode *inode,
+               off_t offset, off_t bytes)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  ASSERT (f->inode == NULL);
+
+  lock_acquire (&share_lock);
+  f->inode = inode;
+  f->offset = offset;
+  f->bytes = bytes;
+  if (hash_insert (&shared_frames, &f->share_elem) != NULL)
+    f->inode = NULL;
+  lock_release (&share_lock);
+}
+
+/* Moves PAGE, one of several pages mapping frame F, to a new
+   frame holding a copy of F's data, for copy-on-write.  F must
+   be locked, and stays locked.  Returns the new frame, locked,
+   or a null pointer if no frame is available, in which case
+   PAGE still maps F. */
+struct frame *
+frame_copy_and_lock (struct frame *f, struct page *page)
+{
+  struct frame *copy;
+
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  ASSERT (f->ref_cnt > 1);
+
+  list_remove (&page->frame_elem);
+  f->ref_cnt--;
+
+  /* The clock skips F while we hold its lock, so F's data cannot
+     change underneath us. */
+  copy = frame_alloc_and_lock (page);
+  if (copy == NULL)
+    {
+      list_push_back (&f->pages, &page->frame_elem);
+      f->ref_cnt++;
+      return NULL;
+    }
+  page_copy (copy->base, f->base);
+  return copy;
+}
+
 /* Locks P's frame into memory, if it has one.
    Upon return, p->frame will not change until P is unlocked. */
 void
@@ -140,15 +480,21 @@ frame_lock (struct page *p)
     }
 }
 
-/* Releases frame F for use by another page.
-   F must be locked for use by the current process.
-   Any data in F is lost. */
+/* Removes PAGE from the pages mapping frame F and unlocks F.
+   F must be locked for use by the current process.  When the
+   last page is removed, F is released for use by another page
+   and any data in it is lost. */
 void
-frame_free (struct frame *f)
+frame_free (struct frame *f, struct page *page)
 {
   ASSERT (lock_held_by_current_thread (&f->lock));
-          
-  f->page = NULL;
+
+  list_remove (&page->frame_elem);
+  if (--f->ref_cnt == 0)
+    {
+      unshare (f);
+      count_used (-1);
+    }
   lock_release (&f->lock);
 }
 
@@ -160,3 +506,38 @@ frame_unlock (struct frame *f)
   ASSERT (lock_held_by_current_thread (&f->lock));
   lock_release (&f->lock);
 }
+
+/* Prints frame statistics.  The peak number of frames in use,
+   compared across runs with several copies of one program,
+   shows how much sharing of code pages saves. */
+void
+frame_print_stats (void)
+{
+  printf ("Frames: %zu of %zu in use (peak %zu), "
+          "%lld pages mapped to shared frames\n",
+          used_cnt, frame_cnt, peak_used_cnt, share_cnt);
+}
+
+/* Returns a hash value for shared frame E. */
+static unsigned
+share_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry (e, struct frame, share_elem);
+  return (hash_int ((int) (uintptr_t) f->inode) ^ hash_int (f->offset)
+          ^ hash_int (f->bytes));
+}
+
+/* Returns true if shared frame A precedes shared frame B. */
+static bool
+share_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, share_elem);
+  const struct frame *b = hash_entry (b_, struct frame, share_elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  if (a->offset != b->offset)
+    return a->offset < b->offset;
+  return a->bytes < b->bytes;
+}
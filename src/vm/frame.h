@@ -1,23 +1,47 @@
 #ifndef VM_FRAME_H
 #define VM_FRAME_H
 
+#include <hash.h>
+#include <list.h>
 #include <stdbool.h>
+#include "filesys/off_t.h"
 #include "threads/synch.h"
 
+struct inode;
+struct page;
+
 /* A physical frame. */
 struct frame 
   {
     struct lock lock;           /* Prevent simultaneous access. */
     void *base;                 /* Kernel virtual base address. */
-    struct page *page;          /* Mapped process page, if any. */
+    struct list pages;          /* Mapped process pages. */
+    size_t ref_cnt;             /* Number of pages in PAGES. */
+
+    /* Read-only file data shared among processes.
+       Protected by the frame's lock and by share_lock in
+       frame.c, so either one suffices for reading. */
+    struct inode *inode;        /* Inode of file data, or null. */
+    off_t offset;               /* Offset of data in INODE. */
+    off_t bytes;                /* Bytes of data; the rest is zeros. */
+    struct hash_elem share_elem; /* Element in shared frame table. */
   };
 
 void frame_init (void);
+void frame_start_cleaning (void);
 
 struct frame *frame_alloc_and_lock (struct page *);
+struct frame *frame_copy_and_lock (struct frame *, struct page *);
+void frame_attach (struct frame *, struct page *);
+struct frame *frame_share_and_lock (struct page *, struct inode *,
+                                    off_t offset, off_t bytes);
+void frame_publish (struct frame *, struct inode *,
+                    off_t offset, off_t bytes);
 void frame_lock (struct page *);
 
-void frame_free (struct frame *);
+void frame_free (struct frame *, struct page *);
 void frame_unlock (struct frame *);
 
+void frame_print_stats (void);
+
 #endif /* vm/frame.h */
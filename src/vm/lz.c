@@ -0,0 +1,218 @@
+#include "vm/lz.h"
+#include <debug.h>
+#include <string.h>
+
+/* Compressed data is a series of sequences, each of which gives
+   some literal bytes to copy to the output followed by a match,
+   that is, a run of bytes to copy from earlier in the output.  A
+   sequence is:
+
+        - A token byte.  Its high 4 bits are the number of
+          literals, its low 4 bits the match length less
+          MIN_MATCH.  The value 15 in either field means that
+          more length bytes follow.
+
+        - If the literal count is 15 or more, additional length
+          bytes, each added to the count; every byte but the
+          last is 255.
+
+        - The literals.
+
+        - The match offset, the distance back from the current
+          output position, as 2 bytes, least significant first.
+
+        - If the match length is 15 + MIN_MATCH or more,
+          additional length bytes, as for the literal count.
+
+   The last sequence ends after its literals, with no match.  The
+   decompressor recognizes it because the input ends there.
+
+   The compressor finds matches with a hash table of the most
+   recent position at which each 4-byte sequence was seen.  It
+   does no searching beyond that, trading some compression for
+   speed. */
+
+/* Minimum match length. */
+#define MIN_MATCH 4
+
+/* Reads 4 unaligned bytes from P. */
+static inline uint32_t
+read32 (const uint8_t *p)
+{
+  uint32_t x;
+  memcpy (&x, p, sizeof x);
+  return x;
+}
+
+/* Returns the hash table index for the 4 bytes X. */
+static inline size_t
+hash32 (uint32_t x)
+{
+  return (x * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Writes the extra length bytes for length N to OP and returns
+   the updated output pointer. */
+static uint8_t *
+put_length (uint8_t *op, size_t n)
+{
+  for (; n >= 255; n -= 255)
+    *op++ = 255;
+  *op++ = n;
+  return op;
+}
+
+/* Appends a sequence of the LIT_CNT literal bytes at LIT and a
+   MATCH_LEN-byte match at distance OFFSET, or no match if
+   MATCH_LEN is 0, to *OP, which may not advance past OEND.
+   Returns true if successful, false if there is not enough
+   room. */
+static bool
+put_sequence (uint8_t **op, uint8_t *oend, const uint8_t *lit,
+              size_t lit_cnt, size_t offset, size_t match_len)
+{
+  size_t match_code = match_len > 0 ? match_len - MIN_MATCH : 0;
+  size_t need = 1 + lit_cnt / 255 + 1 + lit_cnt;
+  uint8_t *o = *op;
+
+  if (match_len > 0)
+    need += 2 + match_code / 255 + 1;
+  if (need > (size_t) (oend - o))
+    return false;
+
+  *o++ = ((lit_cnt < 15 ? lit_cnt : 15) << 4
+          | (match_code < 15 ? match_code : 15));
+  if (lit_cnt >= 15)
+    o = put_length (o, lit_cnt - 15);
+  memcpy (o, lit, lit_cnt);
+  o += lit_cnt;
+  if (match_len > 0)
+    {
+      *o++ = offset;
+      *o++ = offset >> 8;
+      if (match_code >= 15)
+        o = put_length (o, match_code - 15);
+    }
+
+  *op = o;
+  return true;
+}
+
+/* Compresses the SIZE bytes at SRC into the DST_SIZE bytes at
+   DST, using WORK, which must be LZ_WORK_SIZE bytes aligned on a
+   2-byte boundary, for scratch space.  Returns the size of the
+   compressed data, or 0 if it would not fit in DST_SIZE bytes. */
+size_t
+lz_compress (const void *src_, size_t size, void *dst_, size_t dst_size,
+             void *work)
+{
+  const uint8_t *src = src_;
+  const uint8_t *end = src + size;
+  const uint8_t *match_limit = size >= MIN_MATCH ? end - MIN_MATCH + 1 : src;
+  const uint8_t *ip = src;
+  const uint8_t *anchor = src;
+  uint8_t *dst = dst_;
+  uint8_t *op = dst;
+  uint16_t *table = work;
+
+  ASSERT (size <= LZ_MAX_SIZE);
+
+  memset (table, 0, LZ_WORK_SIZE);
+  while (ip < match_limit)
+    {
+      uint32_t seq = read32 (ip);
+      size_t h = hash32 (seq);
+      const uint8_t *ref = src + table[h];
+      const uint8_t *m, *r;
+
+      table[h] = ip - src;
+      if (ref >= ip || read32 (ref) != seq)
+        {
+          ip++;
+          continue;
+        }
+
+      /* Extend the match as far as it goes. */
+      for (m = ip + MIN_MATCH, r = ref + MIN_MATCH; m < end && *m == *r;
+           m++, r++)
+        continue;
+
+      if (!put_sequence (&op, dst + dst_size, anchor, ip - anchor,
+                         ip - ref, m - ip))
+        return 0;
+      ip = anchor = m;
+    }
+
+  if (!put_sequence (&op, dst + dst_size, anchor, end - anchor, 0, 0))
+    return 0;
+  return op - dst;
+}
+
+/* Reads extra length bytes from *IP, which may not advance past
+   IEND, adding them to *N.  Returns true if successful, false if
+   the input ends first. */
+static bool
+get_length (const uint8_t **ip, const uint8_t *iend, size_t *n)
+{
+  uint8_t b;
+
+  do
+    {
+      if (*ip >= iend)
+        return false;
+      b = *(*ip)++;
+      *n += b;
+    }
+  while (b == 255);
+  return true;
+}
+
+/* Decompresses the SIZE bytes of compressed data at SRC into the
+   DST_SIZE bytes at DST.  Returns true if successful, false if
+   the data is malformed or does not decompress to exactly
+   DST_SIZE bytes. */
+bool
+lz_decompress (const void *src_, size_t size, void *dst_, size_t dst_size)
+{
+  const uint8_t *ip = src_;
+  const uint8_t *iend = ip + size;
+  uint8_t *dst = dst_;
+  uint8_t *op = dst;
+  uint8_t *oend = dst + dst_size;
+
+  while (ip < iend)
+    {
+      unsigned token = *ip++;
+      size_t len = token >> 4;
+      size_t offset;
+      const uint8_t *ref;
+
+      /* Literals. */
+      if (len == 15 && !get_length (&ip, iend, &len))
+        return false;
+      if (len > (size_t) (iend - ip) || len > (size_t) (oend - op))
+        return false;
+      memcpy (op, ip, len);
+      op += len;
+      ip += len;
+      if (ip == iend)
+        break;
+
+      /* Match.  It may overlap its own output, as for a run of
+         one repeated byte, so copy a byte at a time. */
+      if (iend - ip < 2)
+        return false;
+      offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+      len = token & 15;
+      if (len == 15 && !get_length (&ip, iend, &len))
+        return false;
+      len += MIN_MATCH;
+      if (offset == 0 || offset > (size_t) (op - dst)
+          || len > (size_t) (oend - op))
+        return false;
+      for (ref = op - offset; len > 0; len--)
+        *op++ = *ref++;
+    }
+  return op == oend;
+}
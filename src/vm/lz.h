@@ -0,0 +1,25 @@
+#ifndef VM_LZ_H
+#define VM_LZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Fast LZ77-family compression, for compressing pages in memory.
+   See lz.c for the format. */
+
+/* Number of bits in the compressor's hash table index. */
+#define LZ_HASH_BITS 12
+
+/* Bytes of scratch space that lz_compress() needs. */
+#define LZ_WORK_SIZE (sizeof (uint16_t) << LZ_HASH_BITS)
+
+/* Largest block that can be compressed. */
+#define LZ_MAX_SIZE 65536
+
+size_t lz_compress (const void *src, size_t size, void *dst, size_t dst_size,
+                    void *work);
+bool lz_decompress (const void *src, size_t size, void *dst,
+                    size_t dst_size);
+
+#endif /* vm/lz.h */
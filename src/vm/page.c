@@ -5,6 +5,8 @@
 #include "vm/swap.h"
 #include "filesys/file.h"
 #include "threads/malloc.h"
+#include "threads/page-ops.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #include "userprog/pagedir.h"
 #include "threads/vaddr.h"
@@ -13,6 +15,28 @@
 /* Right now it is 1 megabyte. */
 #define STACK_MAX (1024 * 1024)
 
+/* Cache of struct page. */
+static struct kmem_cache *page_cache;
+
+/* Statistics. */
+static long long alloc_cnt;     /* Pages added to page tables. */
+static long long file_in_cnt;   /* Pages read in from files. */
+static long long zero_in_cnt;   /* Pages brought in as zeros. */
+static long long swap_in_cnt;   /* Pages read in from swap. */
+static long long cow_share_cnt; /* Frames shared by fork(). */
+static long long cow_copy_cnt;  /* Frames copied on write. */
+static long long evict_cnt;     /* Pages evicted. */
+static long long evict_write_cnt; /* ...that had to be written first. */
+static long long clean_file_cnt; /* Pages written to files early. */
+static long long clean_swap_cnt; /* Pages written to swap early. */
+
+/* Initializes the supplemental page table module. */
+void
+page_init (void)
+{
+  page_cache = kmem_cache_create ("page", sizeof (struct page), NULL);
+}
+
 /* Destroys a page, which must be in the current process's
    page table.  Used as a callback for hash_destroy(). */
 static void
@@ -20,18 +44,43 @@ destroy_page (struct hash_elem *p_, void *aux UNUSED)
 {
   struct page *p = hash_entry (p_, struct page, hash_elem);
   frame_lock (p);
+  if (p->sector != (block_sector_t) -1)
+    swap_free (p);
   if (p->frame)
-    frame_free (p->frame);
-  free (p);
+    frame_free (p->frame, p);
+  kmem_cache_free (page_cache, p);
 }
 
 /* Destroys the current process's page table. */
 void
 page_exit (void)
 {
-  struct hash *h = thread_current ()->pages;
+  struct thread *t = thread_current ();
+  struct hash *h = t->pages;
   if (h != NULL)
-    hash_destroy (h, destroy_page);
+    {
+      hash_destroy (h, destroy_page);
+      t->pages = NULL;
+      free (h);
+    }
+}
+
+/* Prints paging statistics.  Comparing the pages faulted in
+   against the pages mapped shows how much of each executable
+   was never touched. */
+void
+page_print_stats (void)
+{
+  printf ("Paging: %lld pages mapped, %lld faulted in "
+          "(%lld from file, %lld zeroed, %lld from swap)\n",
+          alloc_cnt, file_in_cnt + zero_in_cnt + swap_in_cnt,
+          file_in_cnt, zero_in_cnt, swap_in_cnt);
+  printf ("Paging: %lld pages shared by fork, %lld copied on write\n",
+          cow_share_cnt, cow_copy_cnt);
+  printf ("Paging: %lld pages evicted, %lld written at eviction, "
+          "%lld written early by the cleaner (%lld to files, %lld to swap)\n",
+          evict_cnt, evict_write_cnt, clean_file_cnt + clean_swap_cnt,
+          clean_file_cnt, clean_swap_cnt);
 }
 
 /* Returns the page containing the given virtual ADDRESS,
@@ -67,11 +116,38 @@ page_for_addr (const void *address)
   return NULL;
 }
 
+/* Returns true if page P, which must have a locked frame, may be
+   mapped writable.  A writable page whose frame other pages also
+   map, after fork(), is mapped read-only until it is written, so
+   that the write faults and page_make_writable() can copy it. */
+static bool
+page_writable (struct page *p)
+{
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  return !p->read_only && p->frame->ref_cnt == 1;
+}
+
 /* Locks a frame for page P and pages it in.
    Returns true if successful, false on failure. */
 static bool
 do_page_in (struct page *p)
 {
+  /* Read-only file data, such as program code, may already be in
+     a frame mapped by another process running the same
+     executable. */
+  bool shareable = (p->read_only && p->file != NULL
+                    && p->sector == (block_sector_t) -1);
+  struct inode *inode = shareable ? file_get_inode (p->file) : NULL;
+  if (shareable)
+    {
+      p->frame = frame_share_and_lock (p, inode, p->file_offset,
+                                       p->file_bytes);
+      if (p->frame != NULL)
+        return true;
+    }
+
   /* Get a frame for the page. */
   p->frame = frame_alloc_and_lock (p);
   if (p->frame == NULL)
@@ -82,6 +158,7 @@ do_page_in (struct page *p)
     {
       /* Get data from swap. */
       swap_in (p);
+      swap_in_cnt++;
     }
   else if (p->file != NULL)
     {
@@ -93,11 +170,15 @@ do_page_in (struct page *p)
       if (read_bytes != p->file_bytes)
         printf ("bytes read (%"PROTd") != bytes requested (%"PROTd")\n",
                 read_bytes, p->file_bytes);
+      file_in_cnt++;
+      if (shareable && read_bytes == p->file_bytes)
+        frame_publish (p->frame, inode, p->file_offset, p->file_bytes);
     }
   else
     {
       /* Provide all-zero page. */
-      memset (p->frame->base, 0, PGSIZE);
+      page_zero (p->frame->base);
+      zero_in_cnt++;
     }
 
   return true;
@@ -129,7 +210,7 @@ page_in (void *fault_addr)
 
   /* Install frame into page table. */
   success = pagedir_set_page (thread_current ()->pagedir, p->addr,
-                              p->frame->base, !p->read_only);
+                              p->frame->base, page_writable (p));
 
   /* Release frame. */
   frame_unlock (p->frame);
@@ -137,13 +218,196 @@ page_in (void *fault_addr)
   return success;
 }
 
+/* Gives P, whose frame is locked and shared copy-on-write with
+   other processes, a copy of the frame's data in a new frame of
+   its own and maps it writable.  Returns true if successful,
+   false if no frame is available.  Either way, P's frame is
+   locked on return. */
+static bool
+copy_shared_frame (struct page *p)
+{
+  struct thread *t = thread_current ();
+  struct frame *f = p->frame;
+  bool success;
+
+  p->frame = frame_copy_and_lock (f, p);
+  if (p->frame == NULL)
+    {
+      p->frame = f;
+      return false;
+    }
+  frame_unlock (f);
+  cow_copy_cnt++;
+
+  pagedir_clear_page (t->pagedir, p->addr);
+  success = pagedir_set_page (t->pagedir, p->addr, p->frame->base, true);
+  pagedir_set_dirty (t->pagedir, p->addr, true);
+  return success;
+}
+
+/* Prepares P, whose frame is locked, to be written by the
+   current process.  If P's frame is shared copy-on-write with
+   other processes, gives P a copy of its own; if P is the last
+   page left mapping it, just restores the write access that
+   fork() took away.  Either way P is marked dirty, instead of
+   counting on the write to do it through the page table entry,
+   which a write through the frame's kernel address would not.
+   Returns true if successful, false if no frame is available.
+   Either way, P's frame is locked on return. */
+static bool
+make_frame_private (struct page *p)
+{
+  struct thread *t = thread_current ();
+
+  if (p->frame->ref_cnt > 1)
+    return copy_shared_frame (p);
+
+  pagedir_set_writable (t->pagedir, p->addr, true);
+  pagedir_set_dirty (t->pagedir, p->addr, true);
+  return true;
+}
+
+/* Makes the page containing ADDR writable by the current
+   process, after a write to it faulted.  If the page's frame is
+   shared copy-on-write with other processes, copies the frame's
+   data to a new frame for this page alone; if this page is the
+   last one left mapping the frame, just makes it writable.  If
+   the page is not in memory, pages it in.
+   Returns true if successful, false if the page is read-only or
+   no frame is available. */
+bool
+page_make_writable (const void *addr)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+  bool success;
+
+  if (t->pages == NULL)
+    return false;
+
+  p = page_for_addr (addr);
+  if (p == NULL || p->read_only)
+    return false;
+
+  frame_lock (p);
+  if (p->frame == NULL)
+    {
+      /* Evicted.  It comes back in a frame of its own. */
+      return page_in ((void *) addr);
+    }
+
+  success = make_frame_private (p);
+  frame_unlock (p->frame);
+  return success;
+}
+
+/* Gives the current process, just created by fork(), a copy of
+   PARENT's address space.  PARENT must be blocked until this
+   returns.
+
+   No data is copied.  Each page of PARENT's that is in memory
+   gets a page in the current process that maps the same frame.
+   Writable pages are made read-only in both processes, so that
+   the first write by either faults and page_make_writable()
+   gives the writer its own copy.  Swapped-out pages are brought
+   back in first so that they can be shared the same way.  Pages
+   still in their file, or never touched, need nothing more than
+   a copy of their description.
+
+   Memory-mapped files are not inherited.  Their pages are
+   written back to the file, not copied, so they can't be shared
+   copy-on-write, and the child has no mapping to unmap them
+   with.  The child's address space has no pages in their place.
+
+   Returns true if successful, false if memory runs out. */
+bool
+page_fork (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+  struct hash_iterator i;
+
+  hash_first (&i, parent->pages);
+  while (hash_next (&i))
+    {
+      struct page *p = hash_entry (hash_cur (&i), struct page, hash_elem);
+      struct page *q;
+      bool dirty;
+
+      /* A writable page that is not private but comes from a file
+         belongs to a memory-mapped file. */
+      if (!p->read_only && !p->private && p->file != NULL)
+        continue;
+
+      q = page_allocate (p->addr, p->read_only);
+      if (q == NULL)
+        return false;
+      q->private = p->private;
+      q->file = p->file;
+      q->file_offset = p->file_offset;
+      q->file_bytes = p->file_bytes;
+
+      frame_lock (p);
+      if (p->frame == NULL && p->sector != (block_sector_t) -1)
+        {
+          if (!do_page_in (p))
+            return false;
+          if (!pagedir_set_page (parent->pagedir, p->addr, p->frame->base,
+                                 page_writable (p)))
+            {
+              frame_unlock (p->frame);
+              return false;
+            }
+        }
+      if (p->frame == NULL)
+        continue;
+
+      /* A page of the parent's that is dirty relative to its file
+         must be dirty in the child too, so that evicting it saves
+         the data rather than dropping it. */
+      dirty = pagedir_is_dirty (parent->pagedir, p->addr);
+      frame_attach (p->frame, q);
+      q->frame = p->frame;
+      pagedir_set_writable (parent->pagedir, p->addr, false);
+      if (!pagedir_set_page (t->pagedir, q->addr, q->frame->base, false))
+        {
+          frame_unlock (p->frame);
+          return false;
+        }
+      pagedir_set_dirty (t->pagedir, q->addr, dirty);
+      frame_unlock (p->frame);
+      cow_share_cnt++;
+    }
+  return true;
+}
+
+/* Writes page P, which must have a locked frame, to swap.  If
+   CLUSTER is nonnull and not full, instead adds P to CLUSTER, to
+   be written along with other pages by page_out_cluster(), and
+   sets *QUEUED to true.
+   Returns true if successful, false on failure. */
+static bool
+page_swap_out (struct page *p, struct swap_cluster *cluster, bool *queued)
+{
+  if (cluster != NULL && cluster->cnt < SWAP_CLUSTER_PAGES)
+    {
+      cluster->pages[cluster->cnt++] = p;
+      *queued = true;
+      return true;
+    }
+  return swap_out (p);
+}
+
 /* Evicts page P.
    P must have a locked frame.
+   If P must be written to swap and CLUSTER is nonnull, P may
+   instead be added to CLUSTER, in which case P keeps its frame
+   until page_out_cluster() is called on CLUSTER.
    Return true if successful, false on failure. */
 bool
-page_out (struct page *p)
+page_out (struct page *p, struct swap_cluster *cluster)
 {
   bool dirty;
+  bool queued = false;
   bool ok = false;
 
   ASSERT (p->frame != NULL);
@@ -159,6 +423,20 @@ page_out (struct page *p)
   /* If the frame has been modified, set 'dirty' to true. */
   dirty = pagedir_is_dirty (p->thread->pagedir, (const void *) p->addr);
 
+  /* If the page cleaner already wrote the page to swap and it has
+     not been modified since, the copy in swap is all we need.  If
+     it has been modified, that copy is out of date. */
+  if (p->sector != (block_sector_t) -1)
+  {
+    if (!dirty)
+    {
+      p->frame = NULL;
+      evict_cnt++;
+      return true;
+    }
+    swap_free (p);
+  }
+
   /* If the frame is not dirty (and file != NULL), we have sucsessfully evicted the page. */
   if(!dirty)
   {
@@ -170,7 +448,8 @@ page_out (struct page *p)
      'ok'. */
   if (p->file == NULL)
   {
-    ok = swap_out(p);
+    ok = page_swap_out (p, cluster, &queued);
+    evict_write_cnt++;
   }
   /* Otherwise, a file exists for this page. If file contents have been modified, then they must be
      be written back to the file system on disk, or swapped out. This is determined by the private
@@ -181,23 +460,96 @@ page_out (struct page *p)
     {
       if(p->private)
       {
-        ok = swap_out(p);
+        ok = page_swap_out (p, cluster, &queued);
       }
       else
       {
         ok = file_write_at(p->file, (const void *) p->frame->base, p->file_bytes, p->file_offset);
       }
+      evict_write_cnt++;
     }
   }
 
   /* Nullify the frame held by the page. */
-  if(ok)
+  if(ok && !queued)
   {
     p->frame = NULL;
   }
+  if (ok)
+    evict_cnt++;
+  return ok;
+}
+
+/* Writes the pages that page_out() added to CLUSTER to swap and
+   takes them out of their frames, which must still be locked.
+   Returns true if successful, false if swap is full, in which
+   case the pages that could not be written keep their frames. */
+bool
+page_out_cluster (struct swap_cluster *cluster)
+{
+  bool ok = swap_out_cluster (cluster);
+  size_t i;
+
+  for (i = 0; i < cluster->cnt; i++)
+    {
+      struct page *p = cluster->pages[i];
+      if (p->sector != (block_sector_t) -1)
+        p->frame = NULL;
+    }
   return ok;
 }
 
+/* Writes page P, which must have a locked frame, back to its file
+   or to swap, as evicting it would, but leaves it in memory, so
+   that evicting it later needs no write unless it is modified
+   again.  Does nothing if eviction would need no write, or if P
+   has been accessed recently and so will likely be modified
+   again before it is evicted.  Used by the page cleaner.
+   Returns true if P was written. */
+bool
+page_clean (struct page *p)
+{
+  uint32_t *pd = p->thread->pagedir;
+  bool dirty;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  if (p->read_only || pd == NULL || pagedir_is_accessed (pd, p->addr))
+    return false;
+  dirty = pagedir_is_dirty (pd, p->addr);
+
+  /* The dirty bit is cleared before writing, so that a write by
+     the process during the write sets it again. */
+  if (p->file != NULL && !p->private)
+    {
+      /* Memory-mapped file page. */
+      if (!dirty)
+        return false;
+      pagedir_set_dirty (pd, p->addr, false);
+      file_write_at (p->file, p->frame->base, p->file_bytes, p->file_offset);
+      clean_file_cnt++;
+      return true;
+    }
+
+  /* A page that is unmodified since it was read from its file, or
+     since it was last written to swap, is clean already.  A page
+     with no file, such as a stack page, must go to swap even if
+     it is unmodified. */
+  if (!dirty && (p->file != NULL || p->sector != (block_sector_t) -1))
+    return false;
+  if (p->sector != (block_sector_t) -1)
+    swap_free (p);
+  pagedir_set_dirty (pd, p->addr, false);
+  if (!swap_write (p))
+    {
+      pagedir_set_dirty (pd, p->addr, true);
+      return false;
+    }
+  clean_swap_cnt++;
+  return true;
+}
+
 /* Returns true if page P's data has been accessed recently,
    false otherwise.
    P must have a frame locked into memory. */
@@ -222,7 +574,7 @@ struct page *
 page_allocate (void *vaddr, bool read_only)
 {
   struct thread *t = thread_current ();
-  struct page *p = malloc (sizeof *p);
+  struct page *p = kmem_cache_alloc (page_cache);
   if (p != NULL)
     {
       p->addr = pg_round_down (vaddr);
@@ -243,9 +595,11 @@ page_allocate (void *vaddr, bool read_only)
       if (hash_insert (t->pages, &p->hash_elem) != NULL)
         {
           /* Already mapped. */
-          free (p);
+          kmem_cache_free (page_cache, p);
           p = NULL;
         }
+      else
+        alloc_cnt++;
     }
   return p;
 }
@@ -258,15 +612,17 @@ page_deallocate (void *vaddr)
   struct page *p = page_for_addr (vaddr);
   ASSERT (p != NULL);
   frame_lock (p);
+  if (p->sector != (block_sector_t) -1)
+    swap_free (p);
   if (p->frame)
     {
       struct frame *f = p->frame;
       if (p->file && !p->private)
-        page_out (p);
-      frame_free (f);
+        page_out (p, NULL);
+      frame_free (f, p);
     }
   hash_delete (thread_current ()->pages, &p->hash_elem);
-  free (p);
+  kmem_cache_free (page_cache, p);
 }
 
 /* Returns a hash value for the page that E refers to. */
@@ -290,7 +646,13 @@ page_less (const struct hash_elem *a_, const struct hash_elem *b_,
 
 /* Tries to lock the page containing ADDR into physical memory.
    If WILL_WRITE is true, the page must be writeable;
-   otherwise it may be read-only.
+   otherwise it may be read-only.  A writer's page is made
+   private with make_frame_private(), just as a user write fault
+   would: the kernel writes through the frame's kernel address,
+   which bypasses the copy-on-write protection, so without a copy
+   the data would show up in every process sharing the frame, and
+   without the dirty bit page_out() and page_clean() could drop
+   it as clean.
    Returns true if successful, false on failure. */
 bool
 page_lock (const void *addr, bool will_write)
@@ -301,11 +663,18 @@ page_lock (const void *addr, bool will_write)
 
   frame_lock (p);
   if (p->frame == NULL)
-    return (do_page_in (p)
-            && pagedir_set_page (thread_current ()->pagedir, p->addr,
-                                 p->frame->base, !p->read_only));
-  else
-    return true;
+    {
+      if (!do_page_in (p)
+          || !pagedir_set_page (thread_current ()->pagedir, p->addr,
+                                p->frame->base, page_writable (p)))
+        return false;
+    }
+  if (will_write && !make_frame_private (p))
+    {
+      frame_unlock (p->frame);
+      return false;
+    }
+  return true;
 }
 
 /* Unlocks a page locked with page_lock(). */
@@ -6,6 +6,8 @@
 #include "filesys/off_t.h"
 #include "threads/synch.h"
 
+struct swap_cluster;
+
 /* Virtual page. */
 struct page 
   {
@@ -20,8 +22,11 @@ struct page
     /* Set only in owning process context with frame->frame_lock held.
        Cleared only with scan_lock and frame->frame_lock held. */
     struct frame *frame;        /* Page frame. */
+    struct list_elem frame_elem; /* Element in frame's `pages' list. */
 
-    /* Swap information, protected by frame->frame_lock. */
+    /* Swap information, protected by frame->frame_lock.  A page
+       with a frame may also have a copy in swap, written by the
+       page cleaner, which is up to date unless the page is dirty. */
     block_sector_t sector;       /* Starting sector of swap area, or -1. */
     
     /* Memory-mapped file information, protected by frame->frame_lock. */
@@ -32,13 +37,19 @@ struct page
     off_t file_bytes;           /* Bytes to read/write, 1...PGSIZE. */
   };
 
+void page_init (void);
 void page_exit (void);
+void page_print_stats (void);
 
 struct page *page_allocate (void *, bool read_only);
 void page_deallocate (void *vaddr);
 
 bool page_in (void *fault_addr);
-bool page_out (struct page *);
+bool page_make_writable (const void *addr);
+bool page_fork (struct thread *parent);
+bool page_out (struct page *, struct swap_cluster *);
+bool page_out_cluster (struct swap_cluster *);
+bool page_clean (struct page *);
 bool page_accessed_recently (struct page *);
 
 bool page_lock (const void *, bool will_write);
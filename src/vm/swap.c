@@ -1,40 +1,563 @@
 #include "vm/swap.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <list.h>
+#include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include "vm/frame.h"
+#include "vm/lz.h"
 #include "vm/page.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/page-ops.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
+/* Pages are written to swap in clusters: eviction gathers several
+   victim pages and writes them to consecutive swap slots in one
+   transfer, through write_buf.  Pages evicted together are likely
+   to be used together, so when a page is read back in, the slots
+   just after it that hold pages of the same process are read in
+   the same transfer, into ra_buf, and later faults on those pages
+   are satisfied from memory. */
+
 /* The swap device. */
 static struct block *swap_device;
 
 /* Used swap pages. */
 static struct bitmap *swap_bitmap;
 
-/* Protects swap_bitmap. */
+/* A swap slot. */
+struct swap_slot
+  {
+    struct thread *owner;       /* Thread whose page is here, or null
+                                   if free or not yet written. */
+    struct zswap_entry *zentry; /* Compressed copy in memory, or null
+                                   if the data is on disk. */
+  };
+
+/* One per swap page.  Each `zentry' is written only with both
+   zswap_lock and swap_lock held, so either suffices for reading
+   it. */
+static struct swap_slot *slots;
+
+/* Protects swap_bitmap, `slots', and the statistics. */
 static struct lock swap_lock;
 
+/* Buffer for writing a cluster of pages in one transfer. */
+static uint8_t *write_buf;
+static struct lock write_lock;
+
+/* Read-ahead buffer, holding pages read from the slots starting
+   at ra_first.  Bit I in ra_valid is set if the page for slot
+   ra_first + I is present and has not yet been swapped in.
+   Slots are freed only with ra_lock held, so the buffer never
+   holds data for a slot that has been freed and reused.
+
+   The transfer into ra_buf is done without ra_lock.  While it is
+   in progress, ra_busy is true, ra_valid is 0, and ra_pending
+   holds the bits that will become ra_valid when it finishes,
+   less any slots freed in the meantime. */
+static uint8_t *ra_buf;
+static size_t ra_first;
+static unsigned ra_valid;
+static unsigned ra_pending;
+static bool ra_busy;
+static struct lock ra_lock;
+
+/* Statistics. */
+static long long out_cnt;       /* Pages written. */
+static long long out_xfer_cnt;  /* Transfers that wrote them. */
+static long long in_cnt;        /* Pages read. */
+static long long in_xfer_cnt;   /* Transfers that read them. */
+static long long ra_hit_cnt;    /* Pages found in ra_buf. */
+
 /* Number of sectors per page. */
 #define PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
 
+/* Compressed swap cache ("zswap").
+
+   If enabled with -zswap, a page being swapped out is first
+   compressed, and if it shrinks to ZSWAP_MAX_SIZE bytes or less
+   the compressed copy is kept in memory, in the zswap arena,
+   instead of being written to disk.  The page still gets a swap
+   slot, so that under pressure it can be written back: when the
+   arena reaches its size limit, the compressed pages stored
+   longest ago are decompressed and written to their slots to
+   make room.  A page consisting of a single repeated word, such
+   as a page of zeros, needs no arena space at all.
+
+   The arena is made of kernel pages, each holding at most two
+   compressed pages, one at each end, allocated in CHUNK_SIZE
+   units (as in Linux's "zbud").  This keeps allocation simple
+   and bounds fragmentation. */
+
+/* Compress swapped-out pages in memory?
+   Controlled by kernel command-line option "-zswap". */
+bool swap_compress;
+
+/* Largest compressed page kept in memory. */
+#define ZSWAP_MAX_SIZE (PGSIZE / 4 * 3)
+
+/* Most compressed pages written back to make room for one. */
+#define ZSWAP_WRITEBACK_MAX 4
+
+/* Arena allocation unit.  The first chunk of each arena page
+   holds its struct zbud_page. */
+#define CHUNK_SIZE 64
+#define PAGE_CHUNKS (PGSIZE / CHUNK_SIZE)
+
+/* Header of an arena page. */
+struct zbud_page
+  {
+    struct list_elem elem;      /* In `unbuddied' if not full. */
+    uint8_t first_chunks;       /* Chunks used after header, or 0. */
+    uint8_t last_chunks;        /* Chunks used at end of page, or 0. */
+  };
+
+/* A page kept compressed in memory. */
+struct zswap_entry
+  {
+    struct list_elem lru_elem;  /* In zswap_lru, if DATA is nonnull. */
+    size_t slot;                /* Swap slot. */
+    void *data;                 /* Compressed data in arena, or null. */
+    size_t size;                /* Bytes in DATA. */
+    uint32_t fill;              /* If DATA is null, the word that fills
+                                   the page. */
+    bool writing;               /* Being written back from wb_buf? */
+    bool freed;                 /* Slot freed during the write-back? */
+  };
+
+/* Protects everything below. */
+static struct lock zswap_lock;
+
+static struct list unbuddied;   /* Arena pages with a free end. */
+static struct list zswap_lru;   /* Entries with DATA, oldest first. */
+static size_t arena_pages;      /* Pages in the arena. */
+static size_t arena_max_pages;  /* Limit on arena_pages. */
+static struct kmem_cache *zentry_cache;
+
+static uint8_t *zbuf;           /* Output of the compressor. */
+static uint8_t *wb_buf;         /* Page being written back. */
+static bool wb_busy;            /* wb_buf in use? */
+static uint16_t lz_work[LZ_WORK_SIZE / sizeof (uint16_t)];
+
+/* Statistics. */
+static long long zstore_cnt;    /* Pages stored. */
+static long long zsame_cnt;     /* ...of which were one repeated word. */
+static long long zbytes;        /* Compressed bytes stored. */
+static long long zreject_cnt;   /* Pages that did not compress. */
+static long long zfull_cnt;     /* Pages that did not fit. */
+static long long zwb_cnt;       /* Pages written back. */
+static long long zload_cnt;     /* Pages swapped in from memory. */
+
 /* Sets up swap. */
 void
 swap_init (void)
 {
+  size_t slot_cnt = 0;
+
   swap_device = block_get_role (BLOCK_SWAP);
   if (swap_device == NULL)
     {
       printf ("no swap device--swap disabled\n");
-      swap_bitmap = bitmap_create (0);
+      swap_compress = false;
     }
   else
-    swap_bitmap = bitmap_create (block_size (swap_device)
-                                 / PAGE_SECTORS);
+    {
+      slot_cnt = block_size (swap_device) / PAGE_SECTORS;
+      slots = calloc (slot_cnt, sizeof *slots);
+      write_buf = palloc_get_multiple (0, SWAP_CLUSTER_PAGES);
+      ra_buf = palloc_get_multiple (0, SWAP_CLUSTER_PAGES);
+      if ((slot_cnt > 0 && slots == NULL)
+          || write_buf == NULL || ra_buf == NULL)
+        PANIC ("couldn't allocate swap buffers");
+    }
+  swap_bitmap = bitmap_create (slot_cnt);
   if (swap_bitmap == NULL)
     PANIC ("couldn't create swap bitmap");
   lock_init (&swap_lock);
+  lock_init (&write_lock);
+  lock_init (&ra_lock);
+
+  lock_init (&zswap_lock);
+  list_init (&unbuddied);
+  list_init (&zswap_lru);
+  if (swap_compress)
+    {
+      zentry_cache = kmem_cache_create ("zswap entry",
+                                        sizeof (struct zswap_entry), NULL);
+      zbuf = palloc_get_page (0);
+      wb_buf = palloc_get_page (0);
+      if (zbuf == NULL || wb_buf == NULL)
+        PANIC ("couldn't allocate zswap buffers");
+      arena_max_pages = init_ram_pages / 8;
+    }
+}
+
+/* Allocates SIZE bytes in the zswap arena and returns them, or
+   returns a null pointer if the arena is full.
+   zswap_lock must be held. */
+static void *
+zbud_alloc (size_t size)
+{
+  size_t chunks = DIV_ROUND_UP (size, CHUNK_SIZE);
+  struct zbud_page *zp = NULL;
+  struct list_elem *e;
+  uint8_t *p;
+
+  ASSERT (lock_held_by_current_thread (&zswap_lock));
+  ASSERT (chunks < PAGE_CHUNKS);
+
+  for (e = list_begin (&unbuddied); e != list_end (&unbuddied);
+       e = list_next (e))
+    {
+      struct zbud_page *candidate = list_entry (e, struct zbud_page, elem);
+      if (1 + candidate->first_chunks + candidate->last_chunks + chunks
+          <= PAGE_CHUNKS)
+        {
+          zp = candidate;
+          break;
+        }
+    }
+
+  if (zp == NULL)
+    {
+      if (arena_pages >= arena_max_pages)
+        return NULL;
+      zp = palloc_get_page (0);
+      if (zp == NULL)
+        return NULL;
+      arena_pages++;
+      zp->first_chunks = zp->last_chunks = 0;
+      list_push_front (&unbuddied, &zp->elem);
+    }
+
+  /* The end of the page is used only while the start is, so an
+     allocation at the end never starts at the first chunk after
+     the header, and zbud_free() can tell the two apart. */
+  if (zp->first_chunks == 0)
+    {
+      zp->first_chunks = chunks;
+      p = (uint8_t *) zp + CHUNK_SIZE;
+    }
+  else
+    {
+      zp->last_chunks = chunks;
+      p = (uint8_t *) zp + PGSIZE - chunks * CHUNK_SIZE;
+    }
+  if (zp->first_chunks != 0 && zp->last_chunks != 0)
+    list_remove (&zp->elem);
+  return p;
+}
+
+/* Frees P, allocated with zbud_alloc().
+   zswap_lock must be held. */
+static void
+zbud_free (void *p)
+{
+  struct zbud_page *zp = pg_round_down (p);
+  bool was_full = zp->first_chunks != 0 && zp->last_chunks != 0;
+
+  ASSERT (lock_held_by_current_thread (&zswap_lock));
+
+  if ((uint8_t *) p == (uint8_t *) zp + CHUNK_SIZE)
+    zp->first_chunks = 0;
+  else
+    zp->last_chunks = 0;
+
+  if (zp->first_chunks == 0 && zp->last_chunks == 0)
+    {
+      if (!was_full)
+        list_remove (&zp->elem);
+      palloc_free_page (zp);
+      arena_pages--;
+    }
+  else if (was_full)
+    list_push_front (&unbuddied, &zp->elem);
+}
+
+/* Destroys compressed page Z.
+   zswap_lock must be held. */
+static void
+zswap_drop (struct zswap_entry *z)
+{
+  ASSERT (lock_held_by_current_thread (&zswap_lock));
+
+  if (z->data != NULL)
+    {
+      list_remove (&z->lru_elem);
+      zbud_free (z->data);
+    }
+  lock_acquire (&swap_lock);
+  slots[z->slot].zentry = NULL;
+  lock_release (&swap_lock);
+  kmem_cache_free (zentry_cache, z);
+}
+
+/* Writes the compressed page stored longest ago to its swap slot
+   and frees its arena space.  Returns true if successful, false
+   if there is no page to write back or another write-back is
+   using wb_buf.
+   zswap_lock must be held.  It is released during the write. */
+static bool
+zswap_writeback (void)
+{
+  struct zswap_entry *z;
+
+  ASSERT (lock_held_by_current_thread (&zswap_lock));
+
+  if (wb_busy || list_empty (&zswap_lru))
+    return false;
+  z = list_entry (list_pop_front (&zswap_lru), struct zswap_entry, lru_elem);
+
+  /* Detach the page from the arena into wb_buf.  The entry stays
+     in its slot until the data is on disk, so that swap_in() keeps
+     finding it there rather than reading the slot too soon;
+     zswap_load() copies it from wb_buf meanwhile. */
+  if (!lz_decompress (z->data, z->size, wb_buf, PGSIZE))
+    PANIC ("zswap: compressed page for slot %zu is corrupt", z->slot);
+  zbud_free (z->data);
+  z->data = NULL;
+  z->writing = true;
+  wb_busy = true;
+  lock_release (&zswap_lock);
+
+  block_write_multiple (swap_device, z->slot * PAGE_SECTORS, PAGE_SECTORS,
+                        wb_buf);
+
+  lock_acquire (&zswap_lock);
+  wb_busy = false;
+  if (z->freed)
+    {
+      /* free_slot() left the slot for us to free. */
+      lock_acquire (&swap_lock);
+      slots[z->slot].zentry = NULL;
+      bitmap_reset (swap_bitmap, z->slot);
+      lock_release (&swap_lock);
+      kmem_cache_free (zentry_cache, z);
+    }
+  else
+    zswap_drop (z);
+  zwb_cnt++;
+  return true;
+}
+
+/* Tries to keep a compressed copy of page P, which must have a
+   locked frame, in memory instead of writing it to disk.  If
+   successful, allocates a swap slot for it, stores the slot in
+   *SLOT, and returns true.  Otherwise, returns false, and P
+   should be written to disk. */
+static bool
+zswap_store (struct page *p, size_t *slot)
+{
+  const uint32_t *words = p->frame->base;
+  struct zswap_entry *z;
+  size_t word_cnt = PGSIZE / sizeof *words;
+  size_t tries;
+  size_t i;
+
+  if (!swap_compress)
+    return false;
+
+  z = kmem_cache_alloc (zentry_cache);
+  if (z == NULL)
+    return false;
+  z->data = NULL;
+  z->size = 0;
+  z->writing = z->freed = false;
+
+  for (i = 1; i < word_cnt; i++)
+    if (words[i] != words[0])
+      break;
+
+  lock_acquire (&zswap_lock);
+  if (i == word_cnt)
+    z->fill = words[0];
+  else
+    {
+      z->size = lz_compress (words, PGSIZE, zbuf, ZSWAP_MAX_SIZE, lz_work);
+      if (z->size == 0)
+        {
+          zreject_cnt++;
+          goto fail;
+        }
+
+      z->data = zbud_alloc (z->size);
+      for (tries = 0; z->data == NULL && tries < ZSWAP_WRITEBACK_MAX; tries++)
+        if (zswap_writeback ())
+          z->data = zbud_alloc (z->size);
+      if (z->data == NULL)
+        {
+          zfull_cnt++;
+          goto fail;
+        }
+
+      /* A write-back lets go of zswap_lock, and another thread may
+         have used zbuf meanwhile. */
+      if (tries > 0)
+        lz_compress (words, PGSIZE, zbuf, ZSWAP_MAX_SIZE, lz_work);
+      memcpy (z->data, zbuf, z->size);
+    }
+
+  lock_acquire (&swap_lock);
+  *slot = bitmap_scan_and_flip (swap_bitmap, 0, 1, false);
+  if (*slot != BITMAP_ERROR)
+    {
+      z->slot = *slot;
+      slots[*slot].owner = p->thread;
+      slots[*slot].zentry = z;
+    }
+  lock_release (&swap_lock);
+  if (*slot == BITMAP_ERROR)
+    {
+      if (z->data != NULL)
+        zbud_free (z->data);
+      goto fail;
+    }
+
+  if (z->data != NULL)
+    {
+      list_push_back (&zswap_lru, &z->lru_elem);
+      zbytes += z->size;
+    }
+  else
+    zsame_cnt++;
+  zstore_cnt++;
+  lock_release (&zswap_lock);
+  return true;
+
+ fail:
+  lock_release (&zswap_lock);
+  kmem_cache_free (zentry_cache, z);
+  return false;
+}
+
+/* If the data for swap SLOT is compressed in memory, decompresses
+   it into the page at DST, drops the compressed copy, and returns
+   true.  Otherwise, returns false. */
+static bool
+zswap_load (size_t slot, void *dst)
+{
+  struct zswap_entry *z;
+
+  lock_acquire (&zswap_lock);
+  z = slots[slot].zentry;
+  if (z != NULL && z->writing)
+    {
+      /* Being written back.  free_slot() takes care of Z. */
+      page_copy (dst, wb_buf);
+      zload_cnt++;
+    }
+  else if (z != NULL)
+    {
+      if (z->data != NULL)
+        {
+          if (!lz_decompress (z->data, z->size, dst, PGSIZE))
+            PANIC ("zswap: compressed page for slot %zu is corrupt", slot);
+        }
+      else if (z->fill == 0)
+        page_zero (dst);
+      else
+        {
+          uint32_t *words = dst;
+          size_t i;
+
+          for (i = 0; i < PGSIZE / sizeof *words; i++)
+            words[i] = z->fill;
+        }
+      zswap_drop (z);
+      zload_cnt++;
+    }
+  lock_release (&zswap_lock);
+  return z != NULL;
+}
+
+/* Frees swap SLOT.  ra_lock must be held. */
+static void
+free_slot (size_t slot)
+{
+  struct zswap_entry *z;
+  bool writing = false;
+
+  ASSERT (lock_held_by_current_thread (&ra_lock));
+
+  if (slot >= ra_first && slot < ra_first + SWAP_CLUSTER_PAGES)
+    {
+      ra_valid &= ~(1u << (slot - ra_first));
+      ra_pending &= ~(1u << (slot - ra_first));
+    }
+
+  lock_acquire (&zswap_lock);
+  z = slots[slot].zentry;
+  if (z != NULL && z->writing)
+    {
+      /* The slot can't be reused until zswap_writeback() is done
+         writing to it, so leave freeing it to zswap_writeback(). */
+      z->freed = true;
+      writing = true;
+    }
+  else if (z != NULL)
+    zswap_drop (z);
+
+  lock_acquire (&swap_lock);
+  if (!writing)
+    bitmap_reset (swap_bitmap, slot);
+  slots[slot].owner = NULL;
+  lock_release (&swap_lock);
+  lock_release (&zswap_lock);
+}
+
+/* Reads swap SLOT into the page at DST.  If the read-ahead
+   buffer is free, reads it through the buffer, together with as
+   many of the slots just after it as hold pages of OWNER on disk,
+   up to SWAP_CLUSTER_PAGES slots in all, in one transfer.
+   Otherwise another thread's read-ahead is in progress, and only
+   SLOT is read.  ra_lock must be held, and is released during
+   the transfer. */
+static void
+read_ahead (size_t slot, struct thread *owner, void *dst)
+{
+  size_t slot_cnt = bitmap_size (swap_bitmap);
+  size_t cnt = 1;
+
+  ASSERT (lock_held_by_current_thread (&ra_lock));
+
+  lock_acquire (&swap_lock);
+  if (!ra_busy)
+    for (; cnt < SWAP_CLUSTER_PAGES && slot + cnt < slot_cnt; cnt++)
+      if (slots[slot + cnt].owner != owner
+          || slots[slot + cnt].zentry != NULL)
+        break;
+  in_xfer_cnt++;
+  lock_release (&swap_lock);
+
+  if (ra_busy)
+    {
+      lock_release (&ra_lock);
+      block_read_multiple (swap_device, slot * PAGE_SECTORS, PAGE_SECTORS,
+                           dst);
+      lock_acquire (&ra_lock);
+      return;
+    }
+
+  /* Claim ra_buf, then fill it without holding ra_lock. */
+  ra_busy = true;
+  ra_first = slot;
+  ra_valid = 0;
+  ra_pending = (1u << cnt) - 1;
+  lock_release (&ra_lock);
+
+  block_read_multiple (swap_device, slot * PAGE_SECTORS,
+                       cnt * PAGE_SECTORS, ra_buf);
+  page_copy (dst, ra_buf);
+
+  lock_acquire (&ra_lock);
+  ra_valid = ra_pending;
+  ra_busy = false;
 }
 
 /* Swaps in page P, which must have a locked frame
@@ -42,48 +565,205 @@ swap_init (void)
 void
 swap_in (struct page *p)
 {
-  size_t i;
+  size_t slot;
 
   ASSERT (p->frame != NULL);
   ASSERT (lock_held_by_current_thread (&p->frame->lock));
   ASSERT (p->sector != (block_sector_t) -1);
 
-  for (i = 0; i < PAGE_SECTORS; i++)
-    block_read (swap_device, p->sector + i,
-                p->frame->base + i * BLOCK_SECTOR_SIZE);
-  bitmap_reset (swap_bitmap, p->sector / PAGE_SECTORS);
+  slot = p->sector / PAGE_SECTORS;
+
+  lock_acquire (&ra_lock);
+  if (slot >= ra_first && slot < ra_first + SWAP_CLUSTER_PAGES
+      && (ra_valid & (1u << (slot - ra_first))) != 0)
+    {
+      page_copy (p->frame->base, ra_buf + (slot - ra_first) * PGSIZE);
+      ra_hit_cnt++;
+    }
+  else if (!zswap_load (slot, p->frame->base))
+    read_ahead (slot, p->thread, p->frame->base);
+  free_slot (slot);
+  in_cnt++;
+  lock_release (&ra_lock);
+
   p->sector = (block_sector_t) -1;
 }
 
+/* Records that page P is now in swap SLOT. */
+static void
+set_swapped (struct page *p, size_t slot)
+{
+  p->sector = slot * PAGE_SECTORS;
+  p->private = false;
+  p->file = NULL;
+  p->file_offset = 0;
+  p->file_bytes = 0;
+}
+
+/* Writes the CNT pages in PAGES, each of which must have a locked
+   frame, to consecutive swap slots in one transfer.
+   Returns true if successful, false if there is no run of CNT
+   free slots. */
+static bool
+write_pages (struct page **pages, size_t cnt)
+{
+  size_t slot;
+  size_t i;
+
+  ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER_PAGES);
+
+  lock_acquire (&swap_lock);
+  slot = bitmap_scan_and_flip (swap_bitmap, 0, cnt, false);
+  lock_release (&swap_lock);
+  if (slot == BITMAP_ERROR)
+    return false;
+
+  if (cnt == 1)
+    block_write_multiple (swap_device, slot * PAGE_SECTORS, PAGE_SECTORS,
+                          pages[0]->frame->base);
+  else
+    {
+      lock_acquire (&write_lock);
+      for (i = 0; i < cnt; i++)
+        page_copy (write_buf + i * PGSIZE, pages[i]->frame->base);
+      block_write_multiple (swap_device, slot * PAGE_SECTORS,
+                            cnt * PAGE_SECTORS, write_buf);
+      lock_release (&write_lock);
+    }
+
+  /* Only now that the data is on disk may read_ahead() read these
+     slots. */
+  lock_acquire (&swap_lock);
+  for (i = 0; i < cnt; i++)
+    slots[slot + i].owner = pages[i]->thread;
+  out_cnt += cnt;
+  out_xfer_cnt++;
+  lock_release (&swap_lock);
+
+  for (i = 0; i < cnt; i++)
+    set_swapped (pages[i], slot + i);
+  return true;
+}
+
+/* Swaps out page P, which must have a locked frame, to the
+   compressed swap cache if it will go there, otherwise to disk. */
+static bool
+swap_out_compressed (struct page *p)
+{
+  size_t slot;
+
+  if (!zswap_store (p, &slot))
+    return false;
+  set_swapped (p, slot);
+  return true;
+}
+
 /* Swaps out page P, which must have a locked frame. */
 bool
 swap_out (struct page *p)
 {
-  size_t slot;
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  return swap_out_compressed (p) || write_pages (&p, 1);
+}
+
+/* Swaps out the pages in CLUSTER, each of which must have a
+   locked frame.  Pages that go to the compressed swap cache are
+   put there, and the rest are written to disk in one transfer if
+   there are enough consecutive free slots, otherwise one at a
+   time.  Returns true if all of them were swapped out.  On
+   failure, the pages that were swapped out are those whose
+   `sector' is now set. */
+bool
+swap_out_cluster (struct swap_cluster *cluster)
+{
+  struct page *disk_pages[SWAP_CLUSTER_PAGES];
+  size_t disk_cnt = 0;
+  bool ok = true;
   size_t i;
 
+  for (i = 0; i < cluster->cnt; i++)
+    {
+      struct page *p = cluster->pages[i];
+
+      ASSERT (p->frame != NULL);
+      ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+      if (!swap_out_compressed (p))
+        disk_pages[disk_cnt++] = p;
+    }
+
+  if (disk_cnt == 0 || write_pages (disk_pages, disk_cnt))
+    return true;
+
+  for (i = 0; i < disk_cnt; i++)
+    if (!write_pages (&disk_pages[i], 1))
+      ok = false;
+  return ok;
+}
+
+/* Writes a copy of page P, which must have a locked frame and no
+   swap slot, to a swap slot on disk, leaving P in memory with the
+   slot recorded, for the page cleaner.  Unlike swap_out(), never
+   uses the compressed swap cache, which would only duplicate P in
+   memory.  Returns true if successful, false if swap is more than
+   3/4 full, so that copies of pages still in memory never use up
+   the slots that eviction needs. */
+bool
+swap_write (struct page *p)
+{
+  size_t slot_cnt, free_cnt;
+
   ASSERT (p->frame != NULL);
   ASSERT (lock_held_by_current_thread (&p->frame->lock));
+  ASSERT (p->sector == (block_sector_t) -1);
 
   lock_acquire (&swap_lock);
-  slot = bitmap_scan_and_flip (swap_bitmap, 0, 1, false);
+  slot_cnt = bitmap_size (swap_bitmap);
+  free_cnt = bitmap_count (swap_bitmap, 0, slot_cnt, false);
   lock_release (&swap_lock);
-  if (slot == BITMAP_ERROR)
+  if (free_cnt <= slot_cnt / 4)
     return false;
 
-  p->sector = slot * PAGE_SECTORS;
+  return write_pages (&p, 1);
+}
 
-  /*  Write out page sectors for each modified block. */
-  for (i = 0; i < PAGE_SECTORS; i++)
-  {
-    block_write (swap_device, p->sector + i,
-                 (uint8_t *) p->frame->base + i * BLOCK_SECTOR_SIZE);
-  }
+/* Frees the swap slot of page P, because P is being destroyed or
+   because P is in memory and its copy in swap is out of date.
+   If P has a frame, it must be locked. */
+void
+swap_free (struct page *p)
+{
+  ASSERT (p->frame == NULL || lock_held_by_current_thread (&p->frame->lock));
+  ASSERT (p->sector != (block_sector_t) -1);
 
-  p->private = false;
-  p->file = NULL;
-  p->file_offset = 0;
-  p->file_bytes = 0;
+  lock_acquire (&ra_lock);
+  free_slot (p->sector / PAGE_SECTORS);
+  lock_release (&ra_lock);
+  p->sector = (block_sector_t) -1;
+}
 
-  return true;
+/* Prints swap statistics.  Pages per transfer shows how well
+   clustering and read-ahead are working. */
+void
+swap_print_stats (void)
+{
+  printf ("Swap: %lld pages written in %lld transfers, "
+          "%lld read in %lld transfers (%lld read ahead)\n",
+          out_cnt, out_xfer_cnt, in_cnt, in_xfer_cnt, ra_hit_cnt);
+  if (swap_compress)
+    {
+      long long zdata_cnt = zstore_cnt - zsame_cnt;
+      long long ratio = zbytes > 0 ? zdata_cnt * PGSIZE * 10 / zbytes : 0;
+
+      printf ("Zswap: %lld pages stored in memory (%lld of one repeated "
+              "word), compression ratio %lld.%lld:1, "
+              "%lld incompressible, %lld did not fit\n",
+              zstore_cnt, zsame_cnt, ratio / 10, ratio % 10,
+              zreject_cnt, zfull_cnt);
+      printf ("Zswap: %lld swapped in from memory, %lld written back, "
+              "%zu arena pages in use of %zu\n",
+              zload_cnt, zwb_cnt, arena_pages, arena_max_pages);
+    }
 }
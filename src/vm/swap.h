@@ -2,10 +2,31 @@
 #define VM_SWAP_H 1
 
 #include <stdbool.h>
+#include <stddef.h>
 
 struct page;
+
+/* Maximum number of pages written to swap, or read from it, in
+   one transfer. */
+#define SWAP_CLUSTER_PAGES 8
+
+/* Pages to be written to swap together, by swap_out_cluster(). */
+struct swap_cluster
+  {
+    struct page *pages[SWAP_CLUSTER_PAGES];
+    size_t cnt;
+  };
+
+/* Compress swapped-out pages in memory?
+   Controlled by kernel command-line option "-zswap". */
+extern bool swap_compress;
+
 void swap_init (void);
 void swap_in (struct page *);
 bool swap_out (struct page *);
+bool swap_out_cluster (struct swap_cluster *);
+bool swap_write (struct page *);
+void swap_free (struct page *);
+void swap_print_stats (void);
 
 #endif /* vm/swap.h */